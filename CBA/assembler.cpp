@@ -2,42 +2,24 @@
 #include "opcode.h"
 #include <fstream>
 #include <algorithm>
-#include <unordered_map>
-#include <tuple>
 #include <numeric>
+#include <cmath>
 #include "stdafx.h"
 #include "error.h"
-
-uint line_number = 1;
-std::string base_dir;
-std::string output_name;
-std::vector<std::string> file_trace;
-
-static char rom_output[MAX_ROMSIZE];
-static uint rom_index = 0;
-static uint byte_overflow = 0;
-
-std::map<std::string, uint> labels;
-std::unordered_map<std::string, std::string> aliases;
-//std::unordered_map<uint, std::string> pending_lines;
-std::list<std::tuple<uint, uint, std::vector<std::string>>> pending_statements;
-
-static uint formatting_width = 0;
-static uint total_lines;
+#include "lexer.h"
+#include "keyword.h"
+#include "link.h"
+#include "build_cache.h"
+#include "optimize.h"
+#include "cfg.h"
+#include "budget.h"
+#include "table.h"
 
 /*****************************************/
 /*										 */
 /*			AUX FUNCTIONS				 */
 /*                                       */
 /*****************************************/
-static inline void CalculateFormatWidth() {
-	format_width = (total_lines > 0) ? (uint)log10((double)total_lines) + 1 : 1;
-}
-
-static inline bool IsComment(std::string str) {
-	return (str[0] == COMMENT_SYM);
-}
-
 static inline bool IsAlphaNumeric(char c) {
 	return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
 }
@@ -46,52 +28,47 @@ static inline bool IsNumeric(char c) {
 	return c >= '0' && c <= '9';
 }
 
-static bool IsNumeric(std::string str) {
+static inline bool IsHexDigit(char c) {
+	return IsNumeric(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static bool IsNumeric(std::string_view str) {
 	for (const char& c : str) {
 		if (!IsNumeric(c)) return false;
 	}
 	return true;
 }
 
-static bool IsRegister(std::string str) {
-	for (uint i = 0; i < REGISTER_COUNT; i++)
-		if (str == reg_names[i]) return true;
-	return false;
-}
-
-static inline bool LabelExists(std::string label) {
-	return (labels.find(label) != labels.end());
-}
-
-static inline bool AliasExists(std::string name) {
-	return (aliases.find(name) != aliases.end());
-}
-
-static bool ValidBinaryLiteral(std::string str) {
+static bool ValidBinaryLiteral(std::string_view str) {
 	if (str.size() != 4 && str.size() != 8) return false;
 	for (const char& c : str)
 		if (c != '0' && c != '1') return false;
 	return true;
 }
 
-static bool ValidHexLiteral(std::string str) {
-	if (str[0] != '$' && str.substr(0, 2) != "0x") return false;
-	str = (str[0] == '$') ? str.substr(1) : str.substr(2);
+static inline std::string_view HexDigits(std::string_view str) {
+	if (str[0] == '$') return str.substr(1);
+	if (str.size() >= 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) return str.substr(2);
+	return std::string_view();
+}
+
+static bool ValidHexLiteral(std::string_view str) {
+	str = HexDigits(str);
 	if (str.empty() || str.size() > 4) return false;
 	for (const char& c : str) {
-		if ((c < '0' || c > '9') && (c < 'a' || c > 'f')) return false;
+		if (!IsHexDigit(c)) return false;
 	}
 	return true;
 }
 
-static bool ValidDecLiteral(std::string str) {
+static bool ValidDecLiteral(std::string_view str) {
 	for (const char& c : str) {
 		if (c < '0' || c > '9') return false;
 	}
 	return true;
 }
 
-static inline bool ValidLiteral(std::string str) {
+static inline bool ValidLiteral(std::string_view str) {
 	return (ValidHexLiteral(str) || ValidBinaryLiteral(str));
 }
 
@@ -99,46 +76,39 @@ static inline bool AllowedLabelCharacter(const char& c) {
 	return (c == '_') || (c == ':') || IsAlphaNumeric(c);
 }
 
-static inline bool ValidLabelName(std::string str) {
+static inline bool ValidLabelName(std::string_view str) {
 	return (std::find_if_not(str.begin(), str.end(), AllowedLabelCharacter) == str.end());
 }
-static bool ValidLabelDefinition(std::string str) {
-	uint i = str.find(':');
+static bool ValidLabelDefinition(std::string_view str) {
+	size_t i = str.find(':');
 	if (i == str.npos) return false;
 	if (std::count(str.begin(), str.end(), ':') > 1) return false;
 	if (i != str.size() - 1) return false;
 	return ValidLabelName(str);
 }
 
-static inline bool ValidInstruction(std::string str) {
-	return opcode_list.find(str) != opcode_list.end();
-}
-
-static uint RegisterValue(std::string str) {
-	for (uint i = 0; i < REGISTER_COUNT; i++) {
-		if (str == reg_names[i]) return i;
-	}
-	return 0;
-}
-
-static uint GetBinaryValue(std::string str) {
+static uint GetBinaryValue(std::string_view str) {
 	uint result = 0;
 	for (const char& c : str)
 		result = (result << 1) + ((c == '1') ? 1 : 0);
 	return result;
 }
 
-static uint GetHexValue(std::string str) {
+static uint GetHexValue(std::string_view str) {
 	uint result = 0;
-	str = (str[0] == '$') ? str.substr(1) : str.substr(2);
-	for (const char& c : str) {
-		result = (result << 4) + ((c > '9') ? (c - 'a') + 0xA : c - '0');
+	for (const char& c : HexDigits(str)) {
+		if (c >= 'a') result = (result << 4) + (c - 'a') + 0xA;
+		else if (c >= 'A') result = (result << 4) + (c - 'A') + 0xA;
+		else result = (result << 4) + (c - '0');
 	}
 	return result;
 }
 
-static uint GetDecValue(std::string str) {
-	return std::atoi(str.c_str());
+static uint GetDecValue(std::string_view str) {
+	uint result = 0;
+	for (const char& c : str)
+		result = (result * 10) + (c - '0');
+	return result;
 }
 
 static uint GetBitCount(uint value) {
@@ -150,239 +120,748 @@ static uint GetBitCount(uint value) {
 	return result;
 }
 
-static std::string TrimSpaces(std::string str) {
-	if (str[0] == ' ') str = str.substr(str.find_first_not_of(' '));
-	for (uint i = 0; i < str.size();) {
-		if (str[i] == ' ' && (i == str.size() - 1 || str[i + 1] == ' ')) str.erase(i);
-		else i++;
+// Watch mode needs to be able to undo every change the first pass makes to a symbol
+static inline void JournalSymbol(asm_context& ctx, symbol* sym) {
+	if (ctx.options.watch) ctx.journal.push_back({ sym, *sym });
+}
+
+// Objects and optimized ROMs leave every label reference as a fixup, since the
+// addresses can still move after the first pass
+static inline bool DeferLabels(const asm_context& ctx) {
+	return ctx.options.relocatable || ctx.options.optimize;
+}
+
+// Aliases of labels that were not defined yet are memoized on first use once they are
+static bool ResolveAlias(asm_context& ctx, symbol* alias, token* result, std::string_view* symbol_name) {
+	if (alias->target != nullptr) {
+		symbol* target = alias->target;
+		token value;
+		if (target->kind == SYMBOL_ALIAS) {
+			if (!ResolveAlias(ctx, target, &value, symbol_name)) return false;
+		}
+		else if (target->kind == SYMBOL_LABEL && !DeferLabels(ctx)) value = { target->value, target->type, target->bitcount };
+		else {
+			*symbol_name = target->name;
+			return false;
+		}
+		JournalSymbol(ctx, alias);
+		alias->value = value.value;
+		alias->type = value.type;
+		alias->bitcount = value.bitcount;
+		alias->target = nullptr;
 	}
-	return str;
+	*result = { alias->value, alias->type, alias->bitcount };
+	return true;
 }
 
-static bool MakeToken(std::string str, token* result) {
-	if (IsRegister(str)) *result = { RegisterValue(str), TYPE_REGISTER, NULL };
-	else if (LabelExists(str)) *result = { labels[str], TYPE_LITERAL, LITERAL_12 };
-	else if (ValidBinaryLiteral(str)) *result = { GetBinaryValue(str), TYPE_LITERAL, str.size() };
+// On failure, symbol_name is left holding the alias-resolved text of the token
+static bool MakeToken(asm_context& ctx, std::string_view str, token* result, std::string_view* symbol_name) {
+	*symbol_name = str;
+	const keyword* kw = FindKeyword(str);
+	if (kw && kw->kind == KEYWORD_REGISTER) {
+		*result = { kw->id, TYPE_REGISTER, NULL };
+		return true;
+	}
+	symbol* sym = SYM_Find(ctx.symbols, str);
+	//An object's final addresses aren't known until link time (and an optimized
+	//ROM's until the optimizer is done), so every label reference is left for a fixup
+	if (sym && sym->kind == SYMBOL_LABEL && DeferLabels(ctx)) return false;
+	if (sym && sym->kind == SYMBOL_LABEL) *result = { sym->value, sym->type, sym->bitcount };
+	else if (ValidBinaryLiteral(str)) *result = { GetBinaryValue(str), TYPE_LITERAL, (uint)str.size() };
 	else if (ValidHexLiteral(str)) *result = { GetHexValue(str), TYPE_LITERAL, GetBitCount(GetHexValue(str)) };
 	else if (ValidDecLiteral(str)) *result = { GetDecValue(str), TYPE_LITERAL, GetBitCount(GetDecValue(str)) };
-	else if (AliasExists(str)) return MakeToken(aliases[str], result);
+	else if (sym && sym->kind == SYMBOL_ALIAS) return ResolveAlias(ctx, sym, result, symbol_name);
 	else return false;
 	return true;
 }
 
-bool MakeTokens(std::vector<std::string> strings, std::vector<token>& result) {
-	for (auto it = strings.begin() + 1; it != strings.end(); it++) {
+// Strips an optional trailing ':' so both "jp loop" and "jp loop:" refer to loop
+static std::string_view LabelReference(std::string_view str) {
+	if (!str.empty() && str.back() == ':') str.remove_suffix(1);
+	if (str.empty() || str.find(':') != str.npos || !ValidLabelName(str)) return std::string_view();
+	return str;
+}
+
+bool MakeTokens(asm_context& ctx, const lex_token* strings, uint count, operands& result, std::string_view* forward_label) {
+	result.count = 0;
+	if (count - 1 > MAX_OPERANDS) {
+		PushError(ctx, "Too many operands, at most %i are allowed.", MAX_OPERANDS);
+		return false;
+	}
+	for (auto it = strings + 1; it != strings + count; it++) {
 		token new_token = { 0 };
-		if (IsComment(*it)) break;
-		if (MakeToken(*it, &new_token))
-			result.push_back(new_token);
-		else if (ValidLabelDefinition(*it)) {
-			//Potential unencountered label, resolve in second pass
+		std::string_view symbol;
+		if (MakeToken(ctx, it->text, &new_token, &symbol))
+			result.args[result.count++] = new_token;
+		else if (!LabelReference(symbol).empty()) {
+			//Potential unencountered label, patched in by the second pass
+			if (!forward_label->empty()) {
+				PushError(ctx, "Only one undefined label is allowed per instruction.");
+				return false;
+			}
+			*forward_label = LabelReference(symbol);
 			new_token = { 0x000, TYPE_LITERAL, LITERAL_12 };
-			result.push_back(new_token);
-			auto t = std::make_tuple(line_number, rom_index, strings);
-			pending_statements.push_back(t);
+			result.args[result.count++] = new_token;
 		}
 		else {
-			PushError("Invalid token \"%s\"", it->c_str());
+			PushError(ctx, "Invalid token \"%.*s\"", VIEW_ARG(it->text));
 			return false;
 		}
 	}
 	return true;
 }
 
-static std::vector<std::string> StringSplit(std::string str, std::string seperators) {
-	std::vector<std::string> result;
-	str = str.substr(str.find_first_not_of(seperators));
-	while (!str.empty()) {
-		uint i = str.find_first_of(seperators);
-		if (i != std::string::npos) {
-			result.push_back(str.substr(0, i));
-			str = str.substr(i + 1);
-		}
-		else {
-			result.push_back(str);
-			str = "";
-		}
-	}
-	return result;
-}
-
-void PrintLineNumber() {
-	printf("Line %*i: ", formatting_width, line_number);
-}
-
 /*****************************************/
 /*										 */
 /*			MAIN ASM FUNCTIONS			 */
 /*                                       */
 /*****************************************/
-void Byte_Output(byte in) {
-	if (rom_index + 1 <= MAX_ROMSIZE) {
-		rom_output[rom_index++] = in;
+// The optimizer may bring an oversized ROM back under the limit, so it gets
+// to see all of it. Whatever is still over afterwards becomes byte_overflow.
+static uint OutputCapacity(const asm_context& ctx) {
+	return ctx.options.optimize ? ROM_STAGING_SIZE : MAX_ROMSIZE;
+}
+
+void Byte_Output(asm_context& ctx, byte in) {
+	if (ctx.rom_index + 1 <= OutputCapacity(ctx)) {
+		ctx.rom_output[ctx.rom_index++] = in;
 	}
-	else byte_overflow += 1;
+	else ctx.byte_overflow += 1;
 }
-void Word_Output(word in) {
-	Word_Output(in >> 8, in & 0x00FF);
+void Word_Output(asm_context& ctx, word in) {
+	Word_Output(ctx, in >> 8, in & 0x00FF);
 }
-void Word_Output(byte upper, byte lower) {
-	if (rom_index + 2 <= MAX_ROMSIZE) {
-		rom_output[rom_index++] = upper;
-		rom_output[rom_index++] = lower;
+void Word_Output(asm_context& ctx, byte upper, byte lower) {
+	if (ctx.rom_index + 2 <= OutputCapacity(ctx)) {
+		ctx.rom_output[ctx.rom_index++] = upper;
+		ctx.rom_output[ctx.rom_index++] = lower;
 	}
-	else byte_overflow += 2;
+	else ctx.byte_overflow += 2;
+}
+
+static void CollectStats(asm_context& ctx, stopwatch start) {
+	asm_stats& stats = ctx.stats;
+	stats.total_seconds = STATS_Seconds(start);
+	stats.symbols = ctx.symbols.records.size();
+	stats.fixups = ctx.fixups.size();
+	stats.bytes = ctx.rom_index;
+	STATS_ThreadAllocations(&stats.allocations, &stats.allocated_bytes);
+}
+
+// Runs the first pass, and the second unless the output is an object, over
+// a lexed source. path is only used to name the source in errors.
+static void AssembleLexed(asm_context& ctx, std::string path, std::shared_ptr<lexed_file> root) {
+	const lexed_file& source = *root;
+	ctx.source = root;
+	if (!ctx.includes) ctx.includes = std::make_shared<include_cache>();
+	ctx.rom_index = 0;
+
+	ctx.source_files.push_back(path);
+	ctx.file_trace.push_back(ctx.source_files.size() - 1);
+	ctx.stats.files.push_back({ path, 0, source.line_count, (uint)source.tokens.size(), false });
+	double load_seconds = ctx.stats.read_seconds + ctx.stats.lex_seconds;
+	stopwatch timer = STATS_Start();
+	if (ctx.options.watch) ctx.frames.push_back({ ctx.source, 0 });
+	ASM_FirstPass(ctx, source);
+	ctx.frames.clear();
+	double first_pass_seconds = STATS_Seconds(timer);
+	//Reading and lexing includes is counted under those phases instead
+	ctx.stats.first_pass_seconds = first_pass_seconds - (ctx.stats.read_seconds + ctx.stats.lex_seconds - load_seconds);
+	ctx.stats.files[0].seconds = load_seconds + first_pass_seconds;
+	if (ctx.options.optimize) {
+		if (ctx.error_list.empty()) OPT_Optimize(ctx);
+		if (ctx.rom_index > MAX_ROMSIZE) {
+			ctx.byte_overflow += ctx.rom_index - MAX_ROMSIZE;
+			ctx.rom_index = MAX_ROMSIZE;
+		}
+	}
+	if (!ctx.error_list.empty()) return;
+
+	//Objects keep their fixups as relocations for the linker
+	if (ctx.options.relocatable) return;
+
+	timer = STATS_Start();
+	ASM_SecondPass(ctx);
+	ctx.stats.second_pass_seconds = STATS_Seconds(timer);
+	if (ctx.error_list.empty()) BUDGET_Check(ctx);
+}
+
+// Writes "<output>.dot", the finished ROM's basic blocks. Blocks nothing
+// jumps, calls, falls or points ld i into are shaded as unreachable.
+static void WriteGraph(asm_context& ctx) {
+	cfg_graph graph;
+	CFG_FromRom(ctx, graph);
+	std::vector<uint> roots = { 0 };
+	for (const cfg_node& node : graph.nodes) {
+		word address = node.op & 0xFFF;
+		if (node.code && (node.op >> 12) == 0xA && address >= CHIP8_MEMSTART) roots.push_back(address - CHIP8_MEMSTART);
+	}
+	CFG_MarkReachable(graph, roots);
+	std::string output_path = ctx.base_dir + ctx.output_name;
+	std::string graph_path = output_path.substr(0, output_path.find_last_of('.')) + CFG_EXTENSION;
+	if (CFG_WriteDot(ctx, graph, graph_path))
+		PushMessage(ctx, "Wrote %i basic blocks to %s.\n", (uint)graph.blocks.size(), graph_path.c_str());
+	else PushError(ctx, "Could not create/open graph file: \"%s\"", graph_path.c_str());
 }
 
-void ASM_Begin(std::string path) {
-	std::memset(rom_output, NULL, MAX_ROMSIZE);
+static void AssembleSource(asm_context& ctx, std::string path) {
+	std::memset(ctx.rom_output, NULL, sizeof(ctx.rom_output));
 
-	std::ifstream source_file(path);
-	if (!source_file.is_open()) {
-		printf("File \"%s\" could not be opened/found.", path.c_str());
+	stopwatch timer = STATS_Start();
+	std::shared_ptr<lexed_file> root = std::make_shared<lexed_file>();
+	if (!LEX_ReadFile(path, root->source)) {
+		PushError(ctx, "File \"%s\" could not be opened/found.", path.c_str());
 		return;
 	}
-
-	if (path.find_first_of("\\/") != path.npos) {
-		base_dir = path.substr(0, path.find_last_not_of("\\/"));
+	ctx.stats.read_seconds += STATS_Seconds(timer);
+	timer = STATS_Start();
+	LEX_Tokenize(*root);
+	ctx.stats.lex_seconds += STATS_Seconds(timer);
+
+	size_t dir_end = path.find_last_of("\\/");
+	if (dir_end != path.npos) {
+		ctx.base_dir = path.substr(0, dir_end + 1);
 	}
-	else base_dir = "";
-	output_name = path.substr(0, path.find_last_of('.')) + ROM_EXTENSION;
-	
-	printf("Assembling \"%s\"...\n", output_name.c_str());
+	else ctx.base_dir = "";
+	ctx.output_name = path.substr(ctx.base_dir.size(), path.find_last_of('.') - ctx.base_dir.size()) +
+					  (ctx.options.relocatable ? OBJECT_EXTENSION : ROM_EXTENSION);
 
-	rom_index = 0;
+	PushMessage(ctx, "Assembling \"%s\"...\n", ctx.output_name.c_str());
 
-	file_trace.push_back(path);
-	ASM_FirstPass(source_file);
-	if (!error_list.empty()) return;
+	AssembleLexed(ctx, path, root);
+	if (!ctx.error_list.empty()) return;
 
-	ASM_SecondPass();
-	if (!error_list.empty()) return;
+	timer = STATS_Start();
+	if (ctx.options.relocatable) LINK_WriteObject(ctx);
+	else ASM_WriteToFile(ctx);
+	ctx.stats.write_seconds = STATS_Seconds(timer);
+	if (ctx.options.dump_cfg && !ctx.options.relocatable && ctx.error_list.empty()) WriteGraph(ctx);
+}
 
-	ASM_WriteToFile();
+static bool CheckRomSize(asm_context& ctx) {
+	if (ctx.byte_overflow == 0) return true;
+	uint overflow = MAX_ROMSIZE + ctx.byte_overflow;
+	PushError(ctx, "ROM size limit reached: %i/%i bytes (0x%X/0x%X)",
+			  overflow, MAX_ROMSIZE, CHIP8_MEMSIZE + ctx.byte_overflow - 1, CHIP8_MEMSIZE - 1);
+	return false;
 }
 
-void ASM_FirstPass(std::ifstream& file) {
-	if (!file.is_open()) {
-		PushError("File \"%s\" could not be opened/found.", file_trace.back().c_str());
-		file_trace.pop_back();
+void ASM_Begin(asm_context& ctx, std::string path) {
+	stopwatch start = STATS_Start();
+	unsigned long long start_allocations, start_allocated_bytes;
+	STATS_ThreadAllocations(&start_allocations, &start_allocated_bytes);
+	//A cached build would skip writing the graph and the budget report
+	bool use_cache = !ctx.options.cache_dir.empty() && !ctx.options.dump_cfg && !ctx.options.budget;
+	if (!use_cache || !CACHE_Restore(ctx, path)) {
+		AssembleSource(ctx, path);
+		if (use_cache) CACHE_Store(ctx, path);
+	}
+	if (ctx.options.depfile && ctx.error_list.empty()) ASM_WriteDepfile(ctx, ctx.source_files);
+	CollectStats(ctx, start);
+	ctx.stats.allocations -= start_allocations;
+	ctx.stats.allocated_bytes -= start_allocated_bytes;
+}
+
+bool ASM_AssembleBuffer(asm_context& ctx, std::string_view source, std::string name, byte* rom, uint capacity, uint* size) {
+	stopwatch start = STATS_Start();
+	unsigned long long start_allocations, start_allocated_bytes;
+	STATS_ThreadAllocations(&start_allocations, &start_allocated_bytes);
+	std::memset(ctx.rom_output, 0, sizeof(ctx.rom_output));
+	ctx.options.relocatable = false;
+	*size = 0;
+
+	stopwatch timer = STATS_Start();
+	std::shared_ptr<lexed_file> root = std::make_shared<lexed_file>();
+	root->source.assign(source.data(), source.size());
+	LEX_Tokenize(*root);
+	ctx.stats.lex_seconds += STATS_Seconds(timer);
+	ctx.base_dir = "";
+	ctx.output_name = name;
+
+	AssembleLexed(ctx, name, root);
+	if (ctx.error_list.empty() && CheckRomSize(ctx)) {
+		if (ctx.rom_index > capacity)
+			PushError(ctx, "ROM is %i bytes, but the output buffer only holds %i.", ctx.rom_index, capacity);
+		else {
+			std::copy_n(ctx.rom_output, ctx.rom_index, rom);
+			*size = ctx.rom_index;
+		}
+	}
+	CollectStats(ctx, start);
+	ctx.stats.allocations -= start_allocations;
+	ctx.stats.allocated_bytes -= start_allocated_bytes;
+	return ctx.error_list.empty();
+}
+
+// Looks beside the main source first, then in each include directory in turn.
+// If the file isn't anywhere, the path beside the main source is returned.
+static std::string ResolveInclude(const asm_context& ctx, std::string_view name) {
+	std::string path = ctx.base_dir + std::string(name);
+	long long mtime, size;
+	if (ctx.options.include_paths.empty() || INCLUDE_FileStamp(path, &mtime, &size)) return path;
+	for (const std::string& dir : ctx.options.include_paths) {
+		std::string candidate = dir;
+		if (!candidate.empty() && candidate.back() != '/' && candidate.back() != '\\') candidate += '/';
+		candidate += name;
+		if (INCLUDE_FileStamp(candidate, &mtime, &size)) return candidate;
+	}
+	return path;
+}
+
+static void AssembleInstruction(asm_context& ctx, uint id, const lex_token* tstrings, uint count) {
+	operands tokens;
+	std::string_view forward_label;
+	if (!MakeTokens(ctx, tstrings, count, tokens, &forward_label)) return;
+	const opcode& op = opcode_list[id];
+	if (op.min > op.max) {
+		if (tokens.size() != op.min) {
+			PushError(ctx, "%.*s expected %i args, found %i.",
+				VIEW_ARG(tstrings[0].text), op.min, tokens.size());
+			return;
+		}
+	}
+	else if (tokens.size() < op.min || tokens.size() > op.max) {
+		PushError(ctx, "%.*s expected %i-%i args, found %i.",
+			VIEW_ARG(tstrings[0].text), op.min, op.max, tokens.size());
 		return;
 	}
-	{
-		std::string temp;
-		while (std::getline(file, temp))
-			total_lines++;
-		CalculateFormatWidth();
-		file.clear();
-		file.seekg(0, std::ifstream::beg);
-	}
-	
-	line_number = 0;
-	std::string linefeed;
-	while (std::getline(file, linefeed)) {
-		line_number++;
-		if (!linefeed.empty()) {
-			std::transform(linefeed.begin(), linefeed.end(), linefeed.begin(), ::tolower);
-			std::vector<std::string> tstrings = StringSplit(linefeed, " ,\t");
-
-			if (tstrings[0][0] == '.') {
-				//Process directive
-				if (tstrings[0] == ".alias") {
-					if (tstrings.size() - 1 != 2)
-						PushError("Alias expected %i args, found %i", tstrings[0].c_str(), 2, tstrings.size() - 1);
-					else if (AliasExists(tstrings[1]))
-						PushError("Alias %s is already defined.", tstrings[1].c_str());
-					else aliases[tstrings[1]] = tstrings[2];
+	uint start = ctx.rom_index;
+	op.callback(ctx, tokens);
+	//Only the nnn forms (jp, call, ld i, dw) accept a 12-bit placeholder, and
+	//they all keep the address in the low 12 bits of the instruction word.
+	if (!forward_label.empty() && ctx.rom_index == start + INSTRUCTION_SIZE) {
+		ctx.fixups.push_back({ start, FIXUP_NNN, SYM_Intern(ctx.symbols, forward_label),
+							   ctx.file_trace.back(), ctx.line_number });
+	}
+	if (ctx.rom_index > start) {
+		bool data = id == OP_dw || id == OP_db || id == OP_dbs;
+		ctx.emitted.push_back({ start, ctx.rom_index - start, !data, ctx.file_trace.back(), ctx.line_number });
+	}
+}
+
+// Points a label at the next byte to be written
+static bool DefineLabel(asm_context& ctx, std::string_view name) {
+	symbol* label = SYM_Intern(ctx.symbols, name);
+	if (label->kind == SYMBOL_ALIAS) {
+		PushError(ctx, "Label %.*s is already defined as an alias.", VIEW_ARG(label->name));
+		return false;
+	}
+	JournalSymbol(ctx, label);
+	label->kind = SYMBOL_LABEL;
+	label->value = ctx.rom_index + CHIP8_MEMSTART;
+	label->type = TYPE_LITERAL;
+	label->bitcount = LITERAL_12;
+	return true;
+}
+
+// Emits one instruction for a directive, recorded as AssembleInstruction would
+static void DirectiveWord(asm_context& ctx, word op, symbol* target) {
+	uint start = ctx.rom_index;
+	Word_Output(ctx, op);
+	if (ctx.rom_index != start + INSTRUCTION_SIZE) return;
+	if (target) ctx.fixups.push_back({ start, FIXUP_NNN, target, ctx.file_trace.back(), ctx.line_number });
+	ctx.emitted.push_back({ start, INSTRUCTION_SIZE, true, ctx.file_trace.back(), ctx.line_number });
+}
+
+/*
+	.switch vx case0 case1 ... jumps to the vx'th case in constant time:
+		ld v0 vx		(left out for v0)
+		add v0 v0		(entries are 2 bytes; sets vf)
+		jp table v0
+	table:
+		jp case0
+		jp case1 ...
+	The table's label is numbered by the tables before it, and can't clash
+	with a real one, since labels can't hold '@'. Objects keep it to
+	themselves (see LINK_WriteObject).
+*/
+static void AssembleSwitch(asm_context& ctx, const lex_token* tstrings, uint count) {
+	token reg;
+	std::string_view unresolved;
+	if (!MakeToken(ctx, tstrings[1].text, &reg, &unresolved) || reg.type != TYPE_REGISTER || reg.value > VF) {
+		PushError(ctx, "Switch expected a register v0-vf, found \"%.*s\".", VIEW_ARG(tstrings[1].text));
+		return;
+	}
+	uint cases = count - 2;
+	if (cases > SWITCH_MAX_CASES) {
+		PushError(ctx, "Switch takes at most %i case labels, found %i.", SWITCH_MAX_CASES, cases);
+		return;
+	}
+	for (uint c = 2; c < count; c++) {
+		if (LabelReference(tstrings[c].text).empty()) {
+			PushError(ctx, "Invalid label name \"%.*s\"", VIEW_ARG(tstrings[c].text));
+			return;
+		}
+	}
+
+	if (reg.value != V0) DirectiveWord(ctx, 0x8000 | (reg.value << 4), nullptr);
+	DirectiveWord(ctx, 0x8004, nullptr);
+	char name[32];
+	snprintf(name, sizeof(name), "switch@%u", (uint)ctx.jump_tables.size());
+	ctx.jump_tables.push_back({ ctx.rom_index, cases });
+	DirectiveWord(ctx, 0xB000, SYM_Intern(ctx.symbols, name));
+	DefineLabel(ctx, name);
+	for (uint c = 2; c < count; c++) DirectiveWord(ctx, 0x1000, SYM_Intern(ctx.symbols, LabelReference(tstrings[c].text)));
+}
+
+// Label addresses move under -O and in objects, so only aliases of numbers can go in a .table
+static bool TableConstant(asm_context& ctx, std::string_view name, double* value) {
+	const symbol* sym = SYM_Find(ctx.symbols, name);
+	token result;
+	std::string_view unresolved;
+	if (!sym || sym->kind != SYMBOL_ALIAS || !MakeToken(ctx, name, &result, &unresolved) || result.type != TYPE_LITERAL) return false;
+	*value = result.value;
+	return true;
+}
+
+/*
+	.table [label:] first last [clamp|mask] expression writes one byte per
+	index from first to last, the expression's value at i (see table.h).
+	Values are rounded, and must fit in a byte unless clamped or masked.
+*/
+static void AssembleTable(asm_context& ctx, const lex_token* tstrings, uint count) {
+	uint arg = 1;
+	std::string_view label;
+	if (tstrings[arg].text.back() == ':') {
+		if (!ValidLabelDefinition(tstrings[arg].text)) {
+			PushError(ctx, "Invalid label name \"%.*s\"", VIEW_ARG(tstrings[arg].text));
+			return;
+		}
+		label = tstrings[arg++].text;
+		label.remove_suffix(1);
+	}
+	token bounds[2];
+	for (token& bound : bounds) {
+		std::string_view unresolved;
+		if (arg == count || !MakeToken(ctx, tstrings[arg].text, &bound, &unresolved) || bound.type != TYPE_LITERAL) {
+			PushError(ctx, "Table expected a first and last index, found \"%.*s\".", VIEW_ARG((arg < count) ? tstrings[arg].text : ""));
+			return;
+		}
+		arg++;
+	}
+	if (bounds[1].value < bounds[0].value || bounds[1].value - bounds[0].value >= MAX_ROMSIZE) {
+		PushError(ctx, "Table index range %i-%i is empty or too large for a ROM.", bounds[0].value, bounds[1].value);
+		return;
+	}
+	uint mode = TABLE_STRICT;
+	if (arg < count && NoCaseEquals(tstrings[arg].text, "clamp")) mode = TABLE_CLAMP;
+	else if (arg < count && NoCaseEquals(tstrings[arg].text, "mask")) mode = TABLE_MASK;
+	if (mode != TABLE_STRICT) arg++;
+	if (arg == count) {
+		PushError(ctx, "Table expected an expression.");
+		return;
+	}
+
+	//The expression may hold spaces and commas, so it is taken from the source rather than the tokens
+	const char* begin = tstrings[arg].text.data();
+	const char* end = tstrings[count - 1].text.data() + tstrings[count - 1].text.size();
+	table_program program;
+	std::string error;
+	if (!TABLE_Compile(ctx, std::string_view(begin, end - begin), TableConstant, program, error)) {
+		PushError(ctx, "Invalid table expression: %s.", error.c_str());
+		return;
+	}
+	std::vector<byte> values;
+	uint entries = bounds[1].value - bounds[0].value + 1;
+	for (uint i = bounds[0].value; i <= bounds[1].value; i++) {
+		double value = TABLE_Evaluate(program, i, entries);
+		byte result;
+		if (!std::isfinite(value)) {
+			PushError(ctx, "Table expression has no value at i=%i.", i);
+			return;
+		}
+		if (!TABLE_ToByte(value, mode, &result)) {
+			PushError(ctx, "Table value %.0f at i=%i doesn't fit in a byte; use clamp or mask.", floor(value + 0.5), i);
+			return;
+		}
+		values.push_back(result);
+	}
+
+	if (!label.empty() && !DefineLabel(ctx, label)) return;
+	uint start = ctx.rom_index;
+	for (byte value : values) Byte_Output(ctx, value);
+	if (ctx.rom_index > start) ctx.emitted.push_back({ start, ctx.rom_index - start, false, ctx.file_trace.back(), ctx.line_number });
+}
+
+void ASM_FirstPass(asm_context& ctx, const lexed_file& file, uint first_line) {
+	if (first_line == 0) {
+		ctx.stats.lines += file.line_count;
+		ctx.stats.tokens += file.tokens.size();
+	}
+	for (uint index = first_line; index < file.lines.size(); index++) {
+		const lex_line& line = file.lines[index];
+		ctx.line_number = line.number;
+		const lex_token* tstrings = &file.tokens[line.first];
+		uint count = line.count;
+
+		std::string_view first = tstrings[0].text;
+		const keyword* kw = FindKeyword(first);
+		if (first[0] == '.') {
+			//Process directive
+			if (!kw || kw->kind != KEYWORD_DIRECTIVE)
+				PushError(ctx, "Unrecognised directive \"%.*s\".", VIEW_ARG(first));
+			else if (kw->id == DIR_alias) {
+				if (count - 1 != 2) {
+					PushError(ctx, "Alias expected %i args, found %i", 2, count - 1);
+					continue;
+				}
+				symbol* alias = SYM_Intern(ctx.symbols, tstrings[1].text);
+				if (alias->kind != SYMBOL_NONE) {
+					PushError(ctx, "Alias %.*s is already defined.", VIEW_ARG(tstrings[1].text));
+					continue;
 				}
-				else if (tstrings[0] == ".include") {
-					std::ifstream included_file(base_dir + tstrings[1]);
-					file_trace.push_back(base_dir + tstrings[1]);
-					uint temp = line_number;
-					ASM_FirstPass(included_file);
-					line_number = temp;
-					included_file.close();
+				JournalSymbol(ctx, alias);
+				//Resolve the aliased text now so uses don't have to walk the chain
+				token value;
+				std::string_view unresolved;
+				if (MakeToken(ctx, tstrings[2].text, &value, &unresolved)) {
+					alias->value = value.value;
+					alias->type = value.type;
+					alias->bitcount = value.bitcount;
 				}
-				else PushError("Unrecognised directive \"%s\".", tstrings[0].c_str());
+				else if (!LabelReference(unresolved).empty()) {
+					symbol* target = SYM_Intern(ctx.symbols, LabelReference(unresolved));
+					if (target == alias) {
+						PushError(ctx, "Alias %.*s refers to itself.", VIEW_ARG(tstrings[1].text));
+						continue;
+					}
+					alias->target = target;
+				}
+				else {
+					PushError(ctx, "Invalid alias value \"%.*s\"", VIEW_ARG(tstrings[2].text));
+					continue;
+				}
+				alias->kind = SYMBOL_ALIAS;
 			}
-			else if (tstrings[0].find(':') != std::string::npos) {
-				//Process label
-				if (!ValidLabelDefinition(tstrings[0])) {
-					PushError("Invalid label name \"%s\"", tstrings[0].c_str());
+			else if (kw->id == DIR_include) {
+				if (count - 1 != 1) {
+					PushError(ctx, "Include expected %i args, found %i", 1, count - 1);
 					continue;
 				}
-				std::string name = tstrings[0].substr(0, tstrings[0].size() - 1);
-				labels[name] = rom_index + CHIP8_MEMSTART;
+				if (ctx.options.watch) {
+					ctx.frames.back().line = index;
+					ctx.marks.push_back({ ctx.frames, ctx.file_trace, (uint)ctx.source_files.size(),
+										  ctx.rom_index, ctx.byte_overflow, (uint)ctx.fixups.size(), (uint)ctx.budgets.size(),
+										  (uint)ctx.journal.size(), (uint)ctx.error_list.size(),
+										  (uint)ctx.stats.files.size(), ctx.stats.lines, ctx.stats.tokens });
+				}
+				std::string include_path = ResolveInclude(ctx, tstrings[1].text);
+				stopwatch timer = STATS_Start();
+				bool cached;
+				std::shared_ptr<const lexed_file> included_file = INCLUDE_Load(*ctx.includes, include_path, ctx.stats, &cached);
+				if (!included_file) {
+					PushError(ctx, "File \"%s\" could not be opened/found.", include_path.c_str());
+					continue;
+				}
+				ctx.source_files.push_back(include_path);
+				ctx.file_trace.push_back(ctx.source_files.size() - 1);
+				uint file_index = ctx.stats.files.size();
+				ctx.stats.files.push_back({ include_path, 0, included_file->line_count,
+											(uint)included_file->tokens.size(), cached });
+				if (ctx.options.watch) ctx.frames.push_back({ included_file, 0 });
+				ASM_FirstPass(ctx, *included_file);
+				if (ctx.options.watch) ctx.frames.pop_back();
+				ctx.stats.files[file_index].seconds = STATS_Seconds(timer);
+				ctx.line_number = line.number;
 			}
-			else if (ValidInstruction(tstrings[0])) {
-				std::vector<token> tokens;
-				if (MakeTokens(tstrings, tokens)) {
-					opcode& op = opcode_list[tstrings[0]];
-					if (op.min > op.max) {
-						if (tokens.size() != op.min) {
-							PushError("%s expected %i args, found %i.",
-								tstrings[0].c_str(), op.min, tokens.size());
-							continue;
-						}
-					}
-					else if (tokens.size() < op.min || tokens.size() > op.max) {
-						PushError("%s expected %i-%i args, found %i.",
-							tstrings[0].c_str(), op.min, op.max, tokens.size());
-						continue;
-					}
-					op.callback(tokens);
+			else if (kw->id == DIR_table) {
+				if (count < 4) {
+					PushError(ctx, "Table expected a first and last index and an expression, found %i args", count - 1);
+					continue;
 				}
+				AssembleTable(ctx, tstrings, count);
 			}
-			else if (!IsComment(tstrings[0]))
-				PushError("Unknown identifier \"%s\"", tstrings[0].c_str());
-		}
-	}
-	file_trace.pop_back();
-}
-
-void ASM_SecondPass() {
-	uint temp = rom_index;
-	
-	for (auto it = pending_statements.begin(); it != pending_statements.end(); it++) {
-		line_number = std::get<0>(*it);
-		rom_index = std::get<1>(*it);
-		std::vector<std::string> tstrings = std::get<2>(*it);
-		std::vector<token> tokens;
-		if (MakeTokens(tstrings, tokens)) {
-			opcode& op = opcode_list[tstrings[0]];
-			if (op.min > op.max) {
-				if (tokens.size() != op.min) {
-					PushError("%s expected %i args, found %i.",
-						tstrings[0].c_str(), op.min, tokens.size());
+			else if (kw->id == DIR_switch) {
+				if (count < 3) {
+					PushError(ctx, "Switch expected a register and case labels, found %i args", count - 1);
 					continue;
 				}
+				AssembleSwitch(ctx, tstrings, count);
 			}
-			else if (tokens.size() < op.min || tokens.size() > op.max) {
-				PushError("%s expected %i-%i args, found %i.",
-					tstrings[0].c_str(), op.min, op.max, tokens.size());
+			else if (kw->id == DIR_budget) {
+				if (count - 1 != 2) {
+					PushError(ctx, "Budget expected %i args, found %i", 2, count - 1);
+					continue;
+				}
+				std::string_view name = LabelReference(tstrings[1].text);
+				if (name.empty()) {
+					PushError(ctx, "Invalid label name \"%.*s\"", VIEW_ARG(tstrings[1].text));
+					continue;
+				}
+				token cycles;
+				std::string_view unresolved;
+				if (!MakeToken(ctx, tstrings[2].text, &cycles, &unresolved) || cycles.type != TYPE_LITERAL) {
+					PushError(ctx, "Invalid budget \"%.*s\", expected a number of cycles.", VIEW_ARG(tstrings[2].text));
+					continue;
+				}
+				//The label may come later, so it is only looked at once the ROM is done
+				ctx.budgets.push_back({ SYM_Intern(ctx.symbols, name), cycles.value, ctx.file_trace.back(), ctx.line_number });
+			}
+		}
+		else if (first.find(':') != first.npos) {
+			//Process label
+			if (!ValidLabelDefinition(first)) {
+				PushError(ctx, "Invalid label name \"%.*s\"", VIEW_ARG(first));
 				continue;
 			}
-			op.callback(tokens);
+			DefineLabel(ctx, first.substr(0, first.size() - 1));
 		}
+		else if (kw && kw->kind == KEYWORD_OPCODE) {
+			AssembleInstruction(ctx, kw->id, tstrings, count);
+		}
+		else PushError(ctx, "Unknown identifier \"%.*s\"", VIEW_ARG(first));
 	}
-	rom_index = temp;
+	ctx.file_trace.pop_back();
 }
 
-void ASM_WriteToFile() {
-	if (byte_overflow != 0) {
-		uint overflow = MAX_ROMSIZE + byte_overflow;
-		PushError("ROM size limit reached: %i/%i bytes (0x%X/0x%X)",
-				  overflow, MAX_ROMSIZE, CHIP8_MEMSIZE + byte_overflow - 1, CHIP8_MEMSIZE - 1);
+void ASM_PatchField(asm_context& ctx, uint offset, uint kind, uint address) {
+	switch (kind) {
+	case FIXUP_NNN:
+		ctx.rom_output[offset] = (ctx.rom_output[offset] & 0xF0) | (address >> 8);
+		ctx.rom_output[offset + 1] = address & 0xFF;
+		break;
+	}
+}
+
+static void ApplyFixup(asm_context& ctx, const fixup& fix) {
+	if (fix.target->kind != SYMBOL_LABEL) {
+		ctx.file_trace.push_back(fix.file);
+		ctx.line_number = fix.line;
+		PushError(ctx, "Undefined label \"%.*s\".", VIEW_ARG(fix.target->name));
+		ctx.file_trace.pop_back();
 		return;
 	}
-	std::ofstream bin_file(base_dir + output_name, std::ofstream::binary | std::ofstream::trunc);
-	if (!bin_file.is_open()) {
-		printf("Could not create/open binary file: \"%s\"\n", (base_dir + output_name).c_str());
+	ASM_PatchField(ctx, fix.offset, fix.kind, fix.target->value);
+}
+
+void ASM_SecondPass(asm_context& ctx) {
+	for (const fixup& fix : ctx.fixups) ApplyFixup(ctx, fix);
+}
+
+/*
+	Rolls the context back to a mark and runs the first pass from there: the
+	.include the mark sits on, then the rest of every file around it. Fixups
+	from before the mark are only reapplied if their label was redefined or
+	is (still) undefined, since the bytes they patched were not touched.
+	The ROM, and its graph with --cfg, are written again afterwards.
+*/
+void ASM_Reassemble(asm_context& ctx, uint mark_index) {
+	//A failed build may never have got as far as the second pass
+	bool patched = ctx.error_list.empty();
+	layout_mark mark = ctx.marks[mark_index];
+	ctx.marks.resize(mark_index);
+
+	std::vector<symbol*> touched;
+	for (size_t i = ctx.journal.size(); i-- > mark.journal;) {
+		touched.push_back(ctx.journal[i].target);
+		*ctx.journal[i].target = ctx.journal[i].previous;
+	}
+	ctx.journal.resize(mark.journal);
+	ctx.fixups.resize(mark.fixups);
+	ctx.budgets.resize(mark.budgets);
+	while (!ctx.emitted.empty() && ctx.emitted.back().offset >= mark.rom_index) ctx.emitted.pop_back();
+	while (!ctx.jump_tables.empty() && ctx.jump_tables.back().offset >= mark.rom_index) ctx.jump_tables.pop_back();
+	ctx.error_list.resize(mark.errors);
+	ctx.message_list.clear();
+	ctx.source_files.resize(mark.source_file);
+	ctx.stats.files.resize(mark.stats_files);
+	ctx.stats.lines = mark.stats_lines;
+	ctx.stats.tokens = mark.stats_tokens;
+	std::memset(ctx.rom_output + mark.rom_index, 0, sizeof(ctx.rom_output) - mark.rom_index);
+	ctx.rom_index = mark.rom_index;
+	ctx.byte_overflow = mark.byte_overflow;
+
+	PushMessage(ctx, "Reassembling \"%s\" from 0x%X...\n", ctx.output_name.c_str(), mark.rom_index + CHIP8_MEMSTART);
+	ctx.frames = mark.frames;
+	ctx.file_trace = mark.file_trace;
+	while (!ctx.frames.empty()) {
+		pass_frame frame = ctx.frames.back();
+		bool innermost = ctx.frames.size() == mark.frames.size();
+		ASM_FirstPass(ctx, *frame.file, innermost ? frame.line : frame.line + 1);
+		ctx.frames.pop_back();
+	}
+	if (!ctx.error_list.empty()) return;
+
+	for (size_t i = mark.journal; i < ctx.journal.size(); i++) touched.push_back(ctx.journal[i].target);
+	std::sort(touched.begin(), touched.end());
+	for (uint i = 0; i < ctx.fixups.size(); i++) {
+		const fixup& fix = ctx.fixups[i];
+		if (!patched || i >= mark.fixups || fix.target->kind != SYMBOL_LABEL ||
+			std::binary_search(touched.begin(), touched.end(), fix.target)) ApplyFixup(ctx, fix);
+	}
+	if (ctx.error_list.empty()) BUDGET_Check(ctx);
+	if (!ctx.error_list.empty()) return;
+	ASM_WriteToFile(ctx);
+	if (ctx.options.dump_cfg && ctx.error_list.empty()) WriteGraph(ctx);
+	if (ctx.options.depfile && ctx.error_list.empty()) ASM_WriteDepfile(ctx, ctx.source_files);
+}
+
+static bool SameContents(const std::string& path, const char* data, size_t size) {
+	std::ifstream file(path, std::ifstream::binary | std::ifstream::ate);
+	if (!file.is_open() || (size_t)file.tellg() != size) return false;
+	file.seekg(0);
+	std::string existing(size, '\0');
+	file.read(&existing[0], size);
+	return file.good() && std::equal(existing.begin(), existing.end(), data);
+}
+
+bool ASM_WriteOutput(asm_context& ctx, std::string path, const char* data, size_t size, bool* written) {
+	*written = false;
+	if (ctx.options.write_if_changed && SameContents(path, data, size)) return true;
+	std::ofstream file(path, std::ofstream::binary | std::ofstream::trunc);
+	if (!file.is_open()) return false;
+	file.write(data, size);
+	file.flush();
+	*written = true;
+	return file.good();
+}
+
+// Make needs spaces (and '#') escaped in file names
+static std::string DepfileEscape(const std::string& path) {
+	std::string result;
+	for (const char& c : path) {
+		if (c == ' ' || c == '#') result += '\\';
+		else if (c == '$') result += '$';
+		result += c;
+	}
+	return result;
+}
+
+void ASM_WriteDepfile(asm_context& ctx, const std::vector<std::string>& inputs) {
+	std::string output_path = ctx.base_dir + ctx.output_name;
+	std::string depfile_path = output_path.substr(0, output_path.find_last_of('.')) + DEPFILE_EXTENSION;
+	std::vector<std::string> unique_inputs;
+	for (const std::string& input : inputs) {
+		if (std::find(unique_inputs.begin(), unique_inputs.end(), input) == unique_inputs.end())
+			unique_inputs.push_back(input);
+	}
+
+	std::string out = DepfileEscape(output_path) + ":";
+	for (const std::string& input : unique_inputs) out += " \\\n  " + DepfileEscape(input);
+	out += "\n";
+	//An empty rule per dependency, so make doesn't fail when one is deleted
+	for (uint i = 1; i < unique_inputs.size(); i++) out += "\n" + DepfileEscape(unique_inputs[i]) + ":\n";
+
+	bool written;
+	if (!ASM_WriteOutput(ctx, depfile_path, out.data(), out.size(), &written))
+		PushError(ctx, "Could not create/open dependency file: \"%s\"", depfile_path.c_str());
+}
+
+void ASM_WriteToFile(asm_context& ctx) {
+	if (!CheckRomSize(ctx) || ctx.options.in_memory) return;
+	std::string output_path = ctx.base_dir + ctx.output_name;
+	bool written;
+	ctx.output_messages = ctx.message_list.size();
+	if (!ASM_WriteOutput(ctx, output_path, ctx.rom_output, ctx.rom_index, &written)) {
+		PushError(ctx, "Could not create/open binary file: \"%s\"", output_path.c_str());
 		return;
 	}
-	bin_file.write(rom_output, rom_index);
-	bin_file.flush();
-	printf("Wrote %i bytes to %s.\n", rom_index, (base_dir + output_name).c_str());
-	printf("%i bytes remaining (0x%X/0x%X).\n",
-			MAX_ROMSIZE - rom_index, rom_index + CHIP8_MEMSTART, CHIP8_MEMSIZE - 1);
+	if (written) PushMessage(ctx, "Wrote %i bytes to %s.\n", ctx.rom_index, output_path.c_str());
+	else PushMessage(ctx, "%s is unchanged (%i bytes), left as it was.\n", output_path.c_str(), ctx.rom_index);
+	ASM_PushRemaining(ctx);
+}
+
+void ASM_PushRemaining(asm_context& ctx) {
+	PushMessage(ctx, "%i bytes remaining (0x%X/0x%X).\n",
+			MAX_ROMSIZE - ctx.rom_index, ctx.rom_index + CHIP8_MEMSTART, CHIP8_MEMSIZE - 1);
 }
\ No newline at end of file
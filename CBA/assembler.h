@@ -1,19 +1,46 @@
 #ifndef CBA_ASSEMBLER_H
 #define CBA_ASSEMBLER_H
 #include "stdafx.h"
+#include "context.h"
+#include "opcode.h"
 #include <fstream>
 
-extern uint line_number;
-extern std::vector<std::string> file_trace;
+void ASM_Begin(asm_context& ctx, std::string path);
 
-void ASM_Begin(std::string path);
-void ASM_FirstPass(std::ifstream& file);
-void ASM_SecondPass();
-void ASM_WriteToFile();
+// Assembles source straight from memory into rom, which holds capacity bytes,
+// and sets size to the ROM's length. Nothing touches the filesystem except
+// .include, which searches the working directory then options.include_paths.
+// name labels the source in errors. Returns false if there were errors.
+bool ASM_AssembleBuffer(asm_context& ctx, std::string_view source, std::string name, byte* rom, uint capacity, uint* size);
+void ASM_FirstPass(asm_context& ctx, const lexed_file& file, uint first_line = 0);
+void ASM_SecondPass(asm_context& ctx);
+// Checks the ROM fits, then writes it unless options.in_memory is set
+void ASM_WriteToFile(asm_context& ctx);
 
-void Byte_Output(byte in);
-void Word_Output(word in);
-void Word_Output(byte upper, byte lower);
+// Says how much room the ROM leaves, as every ROM write (or cache restore) ends with
+void ASM_PushRemaining(asm_context& ctx);
+
+// Writes data to path, unless options.write_if_changed is set and the file
+// already holds exactly data. written says which. Returns false on failure.
+bool ASM_WriteOutput(asm_context& ctx, std::string path, const char* data, size_t size, bool* written);
+
+// Writes "<output>.d" listing inputs as the output's dependencies, for make
+void ASM_WriteDepfile(asm_context& ctx, const std::vector<std::string>& inputs);
+
+// Writes address into the field of the given FIXUP_ kind at rom_output[offset]
+void ASM_PatchField(asm_context& ctx, uint offset, uint kind, uint address);
+
+// Picks up from ctx.marks[mark_index] after the files it covers have changed
+// (see layout_mark), then reapplies fixups and writes the ROM (and graph).
+void ASM_Reassemble(asm_context& ctx, uint mark_index);
+
+// Turns an instruction's operand text (tokens after the mnemonic) into tokens.
+// An undefined label is left as a 12-bit placeholder and named in forward_label.
+bool MakeTokens(asm_context& ctx, const lex_token* strings, uint count, operands& result, std::string_view* forward_label);
+
+void Byte_Output(asm_context& ctx, byte in);
+void Word_Output(asm_context& ctx, word in);
+void Word_Output(asm_context& ctx, byte upper, byte lower);
 
 void ASM_Compile(const char* path);
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,73 @@
+#include "batch.h"
+#include "assembler.h"
+#include "error.h"
+#include "workpool.h"
+#include <memory>
+
+static std::string TrimLine(const std::string& line) {
+	size_t first = line.find_first_not_of(" \t\r");
+	if (first == line.npos) return "";
+	size_t last = line.find_last_not_of(" \t\r");
+	return line.substr(first, last - first + 1);
+}
+
+static bool IsAbsolutePath(const std::string& path) {
+	if (path.empty()) return false;
+	if (path[0] == '/' || path[0] == '\\') return true;
+	return path.size() > 1 && path[1] == ':';
+}
+
+bool BATCH_ReadManifest(std::string path, std::vector<std::string>& paths) {
+	std::ifstream manifest(path);
+	if (!manifest.is_open()) {
+		printf("Manifest \"%s\" could not be opened/found.\n", path.c_str());
+		return false;
+	}
+	size_t dir_end = path.find_last_of("\\/");
+	std::string manifest_dir = (dir_end != path.npos) ? path.substr(0, dir_end + 1) : "";
+
+	std::string line;
+	while (std::getline(manifest, line)) {
+		line = TrimLine(line);
+		if (line.empty() || line[0] == COMMENT_SYM) continue;
+		paths.push_back(IsAbsolutePath(line) ? line : manifest_dir + line);
+	}
+	return true;
+}
+
+void BATCH_PrintResult(asm_context& ctx) {
+	PrintAllMessages(ctx);
+	if (!ctx.error_list.empty()) {
+		stopwatch timer = STATS_Start();
+		PrintAllErrors(ctx);
+		ctx.stats.error_seconds = STATS_Seconds(timer);
+	}
+	if (ctx.options.print_stats) STATS_Print(ctx);
+}
+
+int BATCH_Assemble(const std::vector<std::string>& paths, uint thread_count, const asm_options& options) {
+	//Every ROM shares one include cache, so common files are only lexed once
+	std::shared_ptr<include_cache> includes = std::make_shared<include_cache>();
+	std::vector<std::unique_ptr<asm_context>> contexts(paths.size());
+	for (auto& ctx : contexts) {
+		ctx.reset(new asm_context());
+		ctx->options = options;
+		ctx->includes = includes;
+	}
+
+	RunJobs(paths.size(), thread_count, [&](uint i) {
+		ASM_Begin(*contexts[i], paths[i]);
+	});
+
+	uint failed = 0;
+	std::vector<const asm_context*> results;
+	for (const auto& ctx : contexts) {
+		BATCH_PrintResult(*ctx);
+		if (!ctx->error_list.empty()) failed++;
+		results.push_back(ctx.get());
+		printf("\n");
+	}
+	printf("Assembled %i/%i ROMs.\n", (uint)(paths.size() - failed), (uint)paths.size());
+	if (!options.stats_json.empty()) STATS_WriteJson(options.stats_json, results);
+	return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,18 @@
+#ifndef CBA_BATCH_H
+#define CBA_BATCH_H
+#pragma once
+#include "stdafx.h"
+#include "context.h"
+
+// Assembles every source in paths, each with its own context, and prints the
+// results in the order given. Returns 0 if every ROM assembled, 1 otherwise.
+int BATCH_Assemble(const std::vector<std::string>& paths, uint thread_count, const asm_options& options);
+
+// Prints a finished context's messages, errors and (if asked for) statistics.
+void BATCH_PrintResult(asm_context& ctx);
+
+// Appends the source paths listed in a manifest file (one per line, '#' for
+// comments). Relative paths are taken relative to the manifest's directory.
+bool BATCH_ReadManifest(std::string path, std::vector<std::string>& paths);
+
+#endif
@@ -0,0 +1,305 @@
+#include "bench.h"
+#include "assembler.h"
+#include "error.h"
+#include "keyword.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <algorithm>
+#include <fstream>
+
+// v0 to v7 get an alias chain each, so operands mix register names and aliases
+#define ALIASED_REGISTERS 8
+
+static uint NextRandom(uint& state) {
+	//xorshift32, so every platform generates the same program
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+static void Append(std::string& out, const char* fmt, ...) {
+	char buffer[256];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(buffer, sizeof(buffer), fmt, args);
+	va_end(args);
+	out += buffer;
+}
+
+static std::string RegisterName(const bench_config& config, uint& state) {
+	uint reg = NextRandom(state) % 16;
+	char name[32];
+	if (config.alias_depth > 0 && reg < ALIASED_REGISTERS && NextRandom(state) % 2)
+		snprintf(name, sizeof(name), "r%u_%u", reg, config.alias_depth - 1);
+	else snprintf(name, sizeof(name), "v%X", reg);
+	return name;
+}
+
+// Picks a label a few labels behind or ahead of the current one
+static uint LabelTarget(const bench_config& config, uint& state, uint current, uint label_count) {
+	uint distance = 1 + NextRandom(state) % 4;
+	bool forward = NextRandom(state) % 100 < config.forward_percent;
+	if (forward && current + distance < label_count) return current + distance;
+	return (current + 1 >= distance) ? current + 1 - distance : 0;
+}
+
+static void AppendInstruction(std::string& out, const bench_config& config, uint& state, uint label, uint label_count) {
+	std::string x = RegisterName(config, state);
+	std::string y = RegisterName(config, state);
+	uint nn = NextRandom(state) & 0xFF;
+	switch (NextRandom(state) % 12) {
+	case 0:  Append(out, "\tld %s, 0x%02X\n", x.c_str(), nn); break;
+	case 1:  Append(out, "\tadd %s, 0x%02X\n", x.c_str(), nn); break;
+	case 2:  Append(out, "\tld %s, %s\n", x.c_str(), y.c_str()); break;
+	case 3:  Append(out, "\tse %s, %u\n", x.c_str(), nn); break;
+	case 4:  Append(out, "\tsne %s, %s\n", x.c_str(), y.c_str()); break;
+	case 5:  Append(out, "\tdraw %s, %s, %u\n", x.c_str(), y.c_str(), 1 + nn % 15); break;
+	case 6:  Append(out, "\tjp L%u\n", LabelTarget(config, state, label, label_count)); break;
+	case 7:  Append(out, "\tcall L%u\n", LabelTarget(config, state, label, label_count)); break;
+	case 8:
+		if (config.data_bytes > 0 && nn < 0x40) Append(out, "\tld i, data\n");
+		else Append(out, "\tld i, L%u\n", LabelTarget(config, state, label, label_count));
+		break;
+	case 9:  Append(out, "\t%s %s, %s\n", (nn % 3 == 0) ? "or" : (nn % 3 == 1) ? "and" : "xor", x.c_str(), y.c_str()); break;
+	case 10: Append(out, "\trand %s, %u%u%u%u%u%u%u%u\n", x.c_str(),
+					(nn >> 7) & 1, (nn >> 6) & 1, (nn >> 5) & 1, (nn >> 4) & 1,
+					(nn >> 3) & 1, (nn >> 2) & 1, (nn >> 1) & 1, nn & 1); break;
+	case 11: Append(out, "\tbcd %s # Store the digits of %s\n", x.c_str(), x.c_str()); break;
+	}
+}
+
+static uint ParseValue(std::string_view text) {
+	uint value = 0;
+	for (char c : text) value = value * 10 + (c - '0');
+	return value;
+}
+
+bool BENCH_ParseConfig(std::string text, bench_config& config) {
+	size_t start = 0;
+	while (start < text.size()) {
+		size_t end = text.find(',', start);
+		if (end == text.npos) end = text.size();
+		std::string_view pair = std::string_view(text).substr(start, end - start);
+		start = end + 1;
+
+		size_t equals = pair.find('=');
+		if (equals == pair.npos) {
+			printf("Expected key=value in benchmark config, found \"%.*s\".\n", VIEW_ARG(pair));
+			return false;
+		}
+		std::string_view key = pair.substr(0, equals);
+		std::string_view value = pair.substr(equals + 1);
+		if (key == "prefix") {
+			config.prefix = std::string(value);
+			continue;
+		}
+		if (value.empty() || value.find_first_not_of("0123456789") != value.npos) {
+			printf("Benchmark option %.*s expects a number.\n", VIEW_ARG(key));
+			return false;
+		}
+		uint number = ParseValue(value);
+		if (key == "lines") config.lines = number;
+		else if (key == "label_every") config.label_every = number;
+		else if (key == "forward_percent") config.forward_percent = number;
+		else if (key == "alias_depth") config.alias_depth = number;
+		else if (key == "includes") config.includes = number;
+		else if (key == "data_bytes") config.data_bytes = number;
+		else if (key == "seed") config.seed = number;
+		else if (key == "iterations") config.iterations = number;
+		else {
+			printf("Unknown benchmark option \"%.*s\".\n", VIEW_ARG(key));
+			return false;
+		}
+	}
+	return true;
+}
+
+std::string BENCH_Generate(const bench_config& config) {
+	uint state = config.seed * 0x9E3779B9 + 1;
+	if (state == 0) state = 1;
+	uint label_every = std::max(config.label_every, 1u);
+	uint label_count = (config.lines + label_every - 1) / label_every;
+	uint file_count = config.includes + 1;
+	std::vector<std::string> sources(file_count);
+
+	std::string& main_source = sources[0];
+	Append(main_source, "# Generated by cba --bench, seed %u\n", config.seed);
+	for (uint reg = 0; reg < ALIASED_REGISTERS && config.alias_depth > 0; reg++) {
+		Append(main_source, ".alias r%u_0 v%X\n", reg, reg);
+		for (uint depth = 1; depth < config.alias_depth; depth++)
+			Append(main_source, ".alias r%u_%u r%u_%u\n", reg, depth, reg, depth - 1);
+	}
+	main_source += "\n";
+
+	//Instructions are split evenly across the files in the order they are
+	//included, so labels are still defined in ascending order
+	for (uint i = 0; i < config.lines; i++) {
+		std::string& out = sources[(unsigned long long)i * file_count / config.lines];
+		uint label = i / label_every;
+		if (i % label_every == 0) Append(out, "\nL%u:\n", label);
+		AppendInstruction(out, config, state, label, label_count);
+	}
+
+	if (config.data_bytes > 0) {
+		std::string& out = sources.back();
+		out += "\ndata:\n";
+		for (uint i = 0; i < config.data_bytes; i += 8) {
+			out += "\tdbs";
+			for (uint j = i; j < i + 8 && j < config.data_bytes; j++)
+				Append(out, " 0x%02X", NextRandom(state) & 0xFF);
+			out += "\n";
+		}
+	}
+
+	size_t dir_end = config.prefix.find_last_of("\\/");
+	std::string include_name = (dir_end != config.prefix.npos) ? config.prefix.substr(dir_end + 1) : config.prefix;
+	for (uint i = 1; i < file_count; i++)
+		Append(main_source, ".include %s_%u.cba\n", include_name.c_str(), i);
+
+	for (uint i = 0; i < file_count; i++) {
+		std::string path = config.prefix + ((i == 0) ? "" : "_" + std::to_string(i)) + ".cba";
+		std::ofstream file(path, std::ofstream::binary | std::ofstream::trunc);
+		if (!file.is_open()) {
+			printf("Could not create benchmark source \"%s\".\n", path.c_str());
+			return "";
+		}
+		file.write(sources[i].data(), sources[i].size());
+	}
+	return config.prefix + ".cba";
+}
+
+/*****************************************/
+/*										 */
+/*			  BENCHMARK RUNNER			 */
+/*                                       */
+/*****************************************/
+// An instruction line from the generated program, for the per-phase benchmarks
+struct bench_instruction {
+	uint id;
+	const lex_token* tokens;
+	uint count;
+	uint first_operand;
+};
+
+template <typename F>
+static std::vector<double> Sample(uint iterations, F body) {
+	std::vector<double> samples;
+	for (uint i = 0; i < iterations; i++) {
+		stopwatch timer = STATS_Start();
+		body();
+		samples.push_back(STATS_Seconds(timer));
+	}
+	return samples;
+}
+
+static void Report(const char* name, std::vector<double> samples, uint items, const char* unit) {
+	std::sort(samples.begin(), samples.end());
+	double median = samples[samples.size() / 2];
+	printf("  %-14s %10.3f ms %10.3f ms", name, median * 1000, samples[0] * 1000);
+	if (items > 0) printf(" %10.1f ns/%s", median * 1e9 / items, unit);
+	printf("\n");
+}
+
+int BENCH_Run(const bench_config& config) {
+	std::string path = BENCH_Generate(config);
+	if (path.empty()) return 1;
+	uint iterations = std::max(config.iterations, 1u);
+	printf("Generated %u instruction lines across %u files from \"%s\" (seed %u).\n",
+		   config.lines, config.includes + 1, path.c_str(), config.seed);
+	printf("Median and best of %u runs.\n\n", iterations);
+
+	//Full assembly, one fresh context (and include cache) per run
+	std::vector<std::vector<double>> phases(6);
+	std::unique_ptr<asm_context> ctx;
+	for (uint i = 0; i < iterations; i++) {
+		ctx.reset(new asm_context());
+		ASM_Begin(*ctx, path);
+		const asm_stats& stats = ctx->stats;
+		double values[] = { stats.read_seconds, stats.lex_seconds, stats.first_pass_seconds,
+							stats.second_pass_seconds, stats.write_seconds, stats.total_seconds };
+		for (uint p = 0; p < phases.size(); p++) phases[p].push_back(values[p]);
+	}
+	//A large program legitimately overflows the ROM, but the front end still
+	//runs in full, so only other errors stop the benchmark
+	if (ctx->error_list.size() > (ctx->byte_overflow ? 1u : 0u)) {
+		PrintAllErrors(*ctx);
+		return 1;
+	}
+	uint lines = ctx->stats.lines;
+	printf("Full assembly (%u lines, %u tokens, %u bytes", lines, ctx->stats.tokens, ctx->rom_index + ctx->byte_overflow);
+	if (ctx->byte_overflow) printf(", overflows the ROM so nothing is written");
+	printf(")\n");
+	const char* phase_names[] = { "Read", "Lex", "First pass", "Second pass", "Write", "Total" };
+	for (uint p = 0; p < phases.size(); p++) Report(phase_names[p], phases[p], lines, "line");
+
+	//Phase benchmarks over the sources and the context from the last run
+	std::vector<lexed_file> files(ctx->source_files.size());
+	for (uint i = 0; i < files.size(); i++) LEX_ReadFile(ctx->source_files[i], files[i].source);
+	uint token_count = 0;
+	std::vector<double> lex_samples = Sample(iterations, [&]() {
+		token_count = 0;
+		for (lexed_file& file : files) {
+			file.tokens.clear();
+			file.lines.clear();
+			LEX_Tokenize(file);
+			token_count += file.tokens.size();
+		}
+	});
+
+	std::vector<bench_instruction> instructions;
+	std::vector<token> operand_tokens;
+	for (const lexed_file& file : files) {
+		for (const lex_line& line : file.lines) {
+			const lex_token* tokens = &file.tokens[line.first];
+			const keyword* kw = FindKeyword(tokens[0].text);
+			if (kw && kw->kind == KEYWORD_OPCODE) instructions.push_back({ kw->id, tokens, line.count, 0 });
+		}
+	}
+	operands args;
+	std::string_view forward_label;
+	for (bench_instruction& instruction : instructions) {
+		forward_label = std::string_view();
+		MakeTokens(*ctx, instruction.tokens, instruction.count, args, &forward_label);
+		instruction.first_operand = operand_tokens.size();
+		operand_tokens.insert(operand_tokens.end(), args.begin(), args.end());
+	}
+	std::vector<double> token_samples = Sample(iterations, [&]() {
+		for (const bench_instruction& instruction : instructions) {
+			forward_label = std::string_view();
+			MakeTokens(*ctx, instruction.tokens, instruction.count, args, &forward_label);
+		}
+	});
+
+	//Includes copying each instruction's operands into place
+	uint rom_index = ctx->rom_index;
+	uint byte_overflow = ctx->byte_overflow;
+	std::vector<double> opcode_samples = Sample(iterations, [&]() {
+		ctx->rom_index = 0;
+		ctx->byte_overflow = 0;
+		for (const bench_instruction& instruction : instructions) {
+			args.count = instruction.count - 1;
+			std::copy_n(&operand_tokens[instruction.first_operand], args.count, args.args);
+			opcode_list[instruction.id].callback(*ctx, args);
+		}
+	});
+	ctx->rom_index = rom_index;
+	ctx->byte_overflow = byte_overflow;
+
+	std::vector<double> fixup_samples = Sample(iterations, [&]() { ASM_SecondPass(*ctx); });
+
+	//The write benchmark writes whatever fits, even if the program overflowed
+	ctx->byte_overflow = 0;
+	std::vector<double> write_samples = Sample(iterations, [&]() {
+		ctx->message_list.clear();
+		ASM_WriteToFile(*ctx);
+	});
+
+	printf("\nPhases in isolation\n");
+	Report("Lex", lex_samples, token_count, "token");
+	Report("MakeTokens", token_samples, instructions.size(), "instr");
+	Report("Opcodes", opcode_samples, instructions.size(), "instr");
+	Report("Second pass", fixup_samples, ctx->fixups.size(), "fixup");
+	Report("Write", write_samples, ctx->rom_index, "byte");
+	return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef CBA_BENCH_H
+#define CBA_BENCH_H
+#pragma once
+#include "stdafx.h"
+
+/*
+	Shape of the synthetic program written by the benchmark generator.
+	The same config and seed always produce byte-identical sources.
+*/
+struct bench_config {
+	uint lines = 20000;			/* Instruction lines, spread over every file */
+	uint label_every = 16;		/* One label per this many instructions */
+	uint forward_percent = 30;	/* Label references that point ahead */
+	uint alias_depth = 3;		/* Length of each register alias chain */
+	uint includes = 4;			/* Files included from the main source */
+	uint data_bytes = 1024;		/* Bytes of dbs data at the end */
+	uint seed = 1;
+	uint iterations = 10;		/* Samples taken per benchmark */
+	std::string prefix = "bench";	/* Generated files are <prefix>.cba, <prefix>_1.cba... */
+};
+
+// Parses "key=value,key=value..." into config. Keys are the field names above.
+bool BENCH_ParseConfig(std::string text, bench_config& config);
+
+// Writes the synthetic program and returns the path of its main source
+// (empty if a file could not be written).
+std::string BENCH_Generate(const bench_config& config);
+
+// Generates the program, then times a full assembly of it followed by the
+// lexer, operand tokenizing, opcode callbacks, second pass and ROM write on
+// their own. Returns 0 on success, 1 if the program could not be generated.
+int BENCH_Run(const bench_config& config);
+
+#endif
@@ -0,0 +1,350 @@
+#include "budget.h"
+#include "cfg.h"
+#include "error.h"
+#include "lexer.h"
+#include "vm.h"
+#include <algorithm>
+#include <queue>
+#include <set>
+#include <stdio.h>
+
+#define OP_TOP(op) ((op) >> 12)
+#define OP_NN(op)  ((op) & 0xFF)
+
+#define X(a) #a,
+static const char* cost_names[COST_COUNT] = {
+	BUDGET_COSTS
+};
+#undef X
+
+// A block, or the rest of the entry block when a routine starts partway in
+struct budget_vertex {
+	bool exit;			/* Ends in ret */
+	unsigned long long best;
+	unsigned long long worst;
+	std::vector<uint> next;
+};
+
+struct budget_state {
+	const cfg_graph& graph;
+	const cost_model& model;
+	std::map<uint, routine_cost> routines;	/* Entry node -> cost */
+	std::set<uint> active;					/* Entries being worked out, for recursion */
+};
+
+static unsigned long long AddCost(unsigned long long a, unsigned long long b) {
+	return (a == BUDGET_UNBOUNDED || b == BUDGET_UNBOUNDED) ? BUDGET_UNBOUNDED : a + b;
+}
+
+static uint ParseNumber(std::string_view text, bool* valid) {
+	uint value = 0;
+	*valid = !text.empty() && text.find_first_not_of("0123456789") == text.npos;
+	for (char c : text) value = value * 10 + (c - '0');
+	return value;
+}
+
+bool BUDGET_ParseModel(std::string text, cost_model& model) {
+	int given[COST_COUNT];
+	std::fill(given, given + COST_COUNT, -1);
+	uint op = 1;
+	given[COST_row] = 1;
+	model.frame = VM_CYCLES_PER_FRAME;
+	size_t start = 0;
+	while (start < text.size()) {
+		size_t end = text.find(',', start);
+		if (end == text.npos) end = text.size();
+		std::string_view pair = std::string_view(text).substr(start, end - start);
+		start = end + 1;
+
+		size_t equals = pair.find('=');
+		if (equals == pair.npos) {
+			printf("Expected key=value in cost model, found \"%.*s\".\n", VIEW_ARG(pair));
+			return false;
+		}
+		std::string_view key = pair.substr(0, equals);
+		bool valid;
+		uint number = ParseNumber(pair.substr(equals + 1), &valid);
+		if (!valid) {
+			printf("Cost model option %.*s expects a number.\n", VIEW_ARG(key));
+			return false;
+		}
+		if (key == "op") op = number;
+		else if (key == "frame") model.frame = number;
+		else {
+			const char** name = std::find_if(cost_names, cost_names + COST_COUNT, [&](const char* n) { return key == n; });
+			if (name == cost_names + COST_COUNT) {
+				printf("Unknown cost model option \"%.*s\".\n", VIEW_ARG(key));
+				return false;
+			}
+			given[name - cost_names] = number;
+		}
+	}
+	if (model.frame == 0) {
+		printf("Cost model frame must be at least 1 cycle.\n");
+		return false;
+	}
+	for (uint c = 0; c < COST_COUNT; c++) model.costs[c] = (given[c] >= 0) ? given[c] : op;
+	return true;
+}
+
+static uint CostKind(word op) {
+	switch (OP_TOP(op)) {
+	case 0x0: return (op == 0x00E0) ? COST_cls : (op == 0x00EE) ? COST_ret : COST_sys;
+	case 0x1: return COST_jp;
+	case 0x2: return COST_call;
+	case 0x3: case 0x4: case 0x5: case 0x9: return COST_skip;
+	case 0x6: case 0x7: case 0x8: return COST_alu;
+	case 0xA: return COST_ldi;
+	case 0xB: return COST_jpv0;
+	case 0xC: return COST_rand;
+	case 0xD: return COST_draw;
+	case 0xE: return COST_skip;
+	}
+	switch (OP_NN(op)) {
+	case 0x0A: return COST_wkp;
+	case 0x07: case 0x15: case 0x18: return COST_timer;
+	case 0x1E: return COST_ldi;
+	case 0x29: return COST_fnt;
+	case 0x33: return COST_bcd;
+	case 0x55: return COST_store;
+	case 0x65: return COST_load;
+	}
+	return COST_alu;
+}
+
+static unsigned long long NodeCost(const cost_model& model, word op) {
+	unsigned long long cost = model.costs[CostKind(op)];
+	if (OP_TOP(op) == 0xD) cost += (unsigned long long)model.costs[COST_row] * (op & 0xF);
+	return cost;
+}
+
+static routine_cost RoutineCost(budget_state& state, uint entry);
+
+// Costs a vertex's own instructions, and whatever it calls
+static void CostVertex(budget_state& state, budget_vertex& vertex, uint first, uint last, routine_cost& result) {
+	const cfg_graph& graph = state.graph;
+	for (uint n = first; n <= last; n++) {
+		const cfg_node& node = graph.nodes[n];
+		if (!node.code) {
+			//Running into data
+			result.flags |= BUDGET_UNKNOWN;
+			vertex.best = vertex.worst = BUDGET_UNBOUNDED;
+			return;
+		}
+		unsigned long long cost = NodeCost(state.model, node.op);
+		vertex.best = AddCost(vertex.best, cost);
+		vertex.worst = AddCost(vertex.worst, cost);
+		if (OP_TOP(node.op) == 0xF && OP_NN(node.op) == 0x0A) result.flags |= BUDGET_WAITS;
+	}
+	const cfg_node& node = graph.nodes[last];
+	uint top = OP_TOP(node.op);
+	int target = (node.target >= 0) ? CFG_NodeAt(graph, node.target) : -1;
+	if ((top == 0xB && node.entries == 0) || ((top == 0x1 || top == 0x2) && target < 0)) {
+		result.flags |= BUDGET_UNKNOWN;
+		vertex.worst = BUDGET_UNBOUNDED;
+		if (top != 0x2) vertex.best = BUDGET_UNBOUNDED;
+	}
+	else if (top == 0x2) {
+		routine_cost callee = RoutineCost(state, target);
+		vertex.best = AddCost(vertex.best, callee.best);
+		vertex.worst = AddCost(vertex.worst, callee.worst);
+		if ((callee.flags & BUDGET_LOOP) && !(result.flags & BUDGET_LOOP)) result.loop = callee.loop;
+		//Whether this routine returns is for its own paths to say
+		result.flags |= callee.flags & ~BUDGET_NO_RET;
+	}
+	vertex.exit = node.op == 0x00EE;
+}
+
+/*
+	Best case is the cheapest path from the entry to a ret. Worst case is
+	the dearest, which only exists if no loop can be reached: a loop is
+	unbounded as far as the graph can tell, so it is flagged instead.
+*/
+static routine_cost RoutineCost(budget_state& state, uint entry) {
+	auto found = state.routines.find(entry);
+	if (found != state.routines.end()) return found->second;
+	if (state.active.count(entry)) return { BUDGET_UNBOUNDED, BUDGET_UNBOUNDED, BUDGET_RECURSION, 0 };
+	state.active.insert(entry);
+
+	const cfg_graph& graph = state.graph;
+	routine_cost result = { BUDGET_UNBOUNDED, BUDGET_UNBOUNDED, 0, 0 };
+	uint entry_block = graph.block_of[entry];
+	uint partial = (uint)graph.blocks.size();
+	uint start = (graph.blocks[entry_block].first == entry) ? entry_block : partial;
+
+	std::vector<budget_vertex> vertices(graph.blocks.size() + 1);
+	std::vector<uint> order;	/* Postorder, for the longest path */
+	std::vector<uint> colour(vertices.size(), 0);	/* Unseen, on the stack, done */
+	std::vector<std::pair<uint, uint>> stack = { { start, 0 } };
+	bool looped = false;
+	while (!stack.empty()) {
+		uint v = stack.back().first;
+		if (colour[v] == 0) {
+			colour[v] = 1;
+			const cfg_block& block = graph.blocks[(v == partial) ? entry_block : v];
+			uint first = (v == partial) ? entry : block.first;
+			CostVertex(state, vertices[v], first, block.first + block.count - 1, result);
+			//Calls are costed in CostVertex, and a jp v0 without a known table is already flagged
+			bool table = graph.nodes[block.first + block.count - 1].entries > 0;
+			for (const cfg_edge& edge : block.successors) {
+				if (edge.kind == CFG_EDGE_CALL || (edge.kind == CFG_EDGE_TABLE && !table)) continue;
+				vertices[v].next.push_back(edge.block);
+			}
+		}
+		uint& edge = stack.back().second;
+		if (edge < vertices[v].next.size()) {
+			uint next = vertices[v].next[edge++];
+			if (colour[next] == 1) {
+				//A loop of its own is named over one in something it calls
+				if (!looped) result.loop = graph.nodes[graph.blocks[next].first].offset;
+				result.flags |= BUDGET_LOOP;
+				looped = true;
+			}
+			else if (colour[next] == 0) stack.push_back({ next, 0 });
+			continue;
+		}
+		colour[v] = 2;
+		order.push_back(v);
+		stack.pop_back();
+	}
+
+	//Cheapest path to a ret (Dijkstra; costs are never negative)
+	std::vector<unsigned long long> cheapest(vertices.size(), BUDGET_UNBOUNDED);
+	typedef std::pair<unsigned long long, uint> queued;
+	std::priority_queue<queued, std::vector<queued>, std::greater<queued>> pending;
+	cheapest[start] = vertices[start].best;
+	pending.push({ cheapest[start], start });
+	while (!pending.empty()) {
+		queued at = pending.top();
+		pending.pop();
+		if (at.first != cheapest[at.second] || at.first == BUDGET_UNBOUNDED) continue;
+		const budget_vertex& vertex = vertices[at.second];
+		if (vertex.exit) {
+			result.best = std::min(result.best, at.first);
+			continue;
+		}
+		for (uint next : vertex.next) {
+			unsigned long long cost = AddCost(at.first, vertices[next].best);
+			if (cost >= cheapest[next]) continue;
+			cheapest[next] = cost;
+			pending.push({ cost, next });
+		}
+	}
+
+	//Dearest path to a ret, over what is now known to be acyclic
+	if (!(result.flags & BUDGET_LOOP)) {
+		const unsigned long long none = BUDGET_UNBOUNDED - 1;
+		std::vector<unsigned long long> dearest(vertices.size(), none);
+		for (uint v : order) {
+			const budget_vertex& vertex = vertices[v];
+			unsigned long long after = vertex.exit ? 0 : none;
+			for (uint next : vertex.next) {
+				if (dearest[next] == none) continue;
+				after = (after == none) ? dearest[next] : std::max(after, dearest[next]);
+			}
+			//A path into something unbounded is unbounded, whether or not it returns
+			if (vertex.worst == BUDGET_UNBOUNDED) dearest[v] = BUDGET_UNBOUNDED;
+			else dearest[v] = (after == none) ? none : AddCost(vertex.worst, after);
+		}
+		if (dearest[start] != none) result.worst = dearest[start];
+	}
+	if (result.best == BUDGET_UNBOUNDED && !(result.flags & (BUDGET_RECURSION | BUDGET_UNKNOWN)))
+		result.flags |= BUDGET_NO_RET;
+
+	state.active.erase(entry);
+	state.routines[entry] = result;
+	return result;
+}
+
+/*****************************************/
+/*										 */
+/*				  REPORT				 */
+/*                                       */
+/*****************************************/
+static std::string AddressName(const std::map<uint, std::string>& labels, uint offset) {
+	auto found = labels.find(offset);
+	if (found != labels.end()) return found->second;
+	char text[16];
+	snprintf(text, sizeof(text), "0x%03X", CHIP8_MEMSTART + offset);
+	return text;
+}
+
+static std::string CostText(unsigned long long cost) {
+	if (cost == BUDGET_UNBOUNDED) return "-";
+	char text[24];
+	snprintf(text, sizeof(text), "%llu", cost);
+	return text;
+}
+
+static std::string Notes(const std::map<uint, std::string>& labels, const routine_cost& cost) {
+	std::string notes;
+	auto note = [&](const std::string& text) { notes += (notes.empty() ? "" : "; ") + text; };
+	if (cost.flags & BUDGET_NO_RET) note("never returns");
+	if (cost.flags & BUDGET_LOOP) note("unbounded loop at " + AddressName(labels, cost.loop));
+	if (cost.flags & BUDGET_RECURSION) note("recursive");
+	if (cost.flags & BUDGET_UNKNOWN) note("jumps where the graph can't follow");
+	if (cost.flags & BUDGET_WAITS) note("waits for a key");
+	return notes;
+}
+
+void BUDGET_Check(asm_context& ctx) {
+	if (!ctx.options.budget && ctx.budgets.empty()) return;
+	cost_model model;
+	//main has already rejected a bad model
+	BUDGET_ParseModel(ctx.options.cost_model, model);
+	cfg_graph graph;
+	CFG_FromRom(ctx, graph);
+	if (graph.nodes.empty()) return;
+	budget_state state = { graph, model };
+
+	//The first label defined at an address names it
+	std::map<uint, std::string> labels;
+	std::vector<const symbol*> sorted;
+	for (const symbol* sym : ctx.symbols.records) {
+		if (sym->kind != SYMBOL_LABEL || SYM_Generated(sym)) continue;
+		labels.emplace(sym->value - CHIP8_MEMSTART, std::string(sym->name));
+		sorted.push_back(sym);
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), [](const symbol* a, const symbol* b) { return a->value < b->value; });
+
+	std::map<const symbol*, uint> declared;
+	for (const budget_decl& budget : ctx.budgets) declared[budget.label] = budget.cycles;
+
+	if (ctx.options.budget) {
+		PushMessage(ctx, "Cycle budget of \"%s\", %u cycles to the frame:\n", ctx.output_name.c_str(), model.frame);
+		PushMessage(ctx, "   %-24s %9s %9s %7s %9s  %s\n", "Label", "Best", "Worst", "Frames", "Budget", "Notes");
+		for (const symbol* sym : sorted) {
+			int node = CFG_NodeAt(graph, sym->value - CHIP8_MEMSTART);
+			if (node < 0 || !graph.nodes[node].code) continue;
+			routine_cost cost = RoutineCost(state, node);
+			char frames[16] = "-";
+			if (cost.worst != BUDGET_UNBOUNDED) snprintf(frames, sizeof(frames), "%.1f", (double)cost.worst / model.frame);
+			auto budget = declared.find(sym);
+			std::string limit = (budget != declared.end()) ? CostText(budget->second) : "";
+			PushMessage(ctx, "   %-24.*s %9s %9s %7s %9s  %s\n", VIEW_ARG(sym->name), CostText(cost.best).c_str(),
+						CostText(cost.worst).c_str(), frames, limit.c_str(), Notes(labels, cost).c_str());
+		}
+	}
+
+	for (const budget_decl& budget : ctx.budgets) {
+		ctx.file_trace.push_back(budget.file);
+		ctx.line_number = budget.line;
+		int node = (budget.label->kind == SYMBOL_LABEL) ? CFG_NodeAt(graph, budget.label->value - CHIP8_MEMSTART) : -1;
+		if (budget.label->kind != SYMBOL_LABEL)
+			PushError(ctx, "Undefined label \"%.*s\" in .budget.", VIEW_ARG(budget.label->name));
+		else if (node < 0 || !graph.nodes[node].code)
+			PushError(ctx, "\"%.*s\" doesn't start any code to budget.", VIEW_ARG(budget.label->name));
+		else {
+			routine_cost cost = RoutineCost(state, node);
+			if (cost.worst == BUDGET_UNBOUNDED) {
+				PushError(ctx, "%.*s has no worst case to hold to its .budget of %u cycles (%s).",
+						  VIEW_ARG(budget.label->name), budget.cycles, Notes(labels, cost).c_str());
+			}
+			else if (cost.worst > budget.cycles) {
+				PushError(ctx, "%.*s takes up to %llu cycles, over its .budget of %u.",
+						  VIEW_ARG(budget.label->name), cost.worst, budget.cycles);
+			}
+		}
+		ctx.file_trace.pop_back();
+	}
+}
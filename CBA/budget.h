@@ -0,0 +1,75 @@
+#ifndef CBA_BUDGET_H
+#define CBA_BUDGET_H
+#pragma once
+#include "stdafx.h"
+#include "context.h"
+
+#define BUDGET_UNBOUNDED 0xFFFFFFFFFFFFFFFFULL
+
+// Why a routine's cost can't be pinned down (routine_cost::flags)
+#define BUDGET_LOOP      0x01	/* A loop nothing bounds */
+#define BUDGET_RECURSION 0x02
+#define BUDGET_UNKNOWN   0x04	/* A jp v0 not made by .switch, or a jump the graph can't follow */
+#define BUDGET_WAITS     0x08	/* A wkp, which takes as long as the player does */
+#define BUDGET_NO_RET    0x10	/* No path reaches a ret */
+
+// What each kind of instruction costs; op sets every one not given
+#define BUDGET_COSTS \
+	X(cls  )\
+	X(ret  )\
+	X(sys  )\
+	X(jp   )\
+	X(call )\
+	X(skip )\
+	X(alu  )\
+	X(ldi  )\
+	X(jpv0 )\
+	X(rand )\
+	X(draw )\
+	X(row  )\
+	X(wkp  )\
+	X(timer)\
+	X(fnt  )\
+	X(bcd  )\
+	X(store)\
+	X(load )
+
+#define X(a) COST_##a,
+enum CostValues {
+	BUDGET_COSTS
+	COST_COUNT
+};
+#undef X
+
+/*
+	Cycles per instruction. draw costs draw plus row for every row of the
+	sprite. By default everything costs one cycle, with VM_CYCLES_PER_FRAME
+	to the frame as on the built-in Chip-8, and each sprite row one more,
+	since drawing is what real interpreters spend their time on.
+*/
+struct cost_model {
+	uint costs[COST_COUNT];
+	uint frame;		/* Cycles in one 60Hz frame */
+};
+
+struct routine_cost {
+	unsigned long long best;	/* Cheapest path to a ret, BUDGET_UNBOUNDED if there is none */
+	unsigned long long worst;	/* Dearest path, BUDGET_UNBOUNDED if flags say it can't be known */
+	uint flags;
+	uint loop;					/* ROM offset of the first unbounded loop found */
+};
+
+// Parses "key=value,..." over the defaults, with keys from BUDGET_COSTS
+// plus op and frame. Prints what is wrong and returns false on a bad config.
+bool BUDGET_ParseModel(std::string text, cost_model& model);
+
+/*
+	Works out the best and worst case cost of every label that starts code
+	in the finished ROM, from its control-flow graph. A path ends at a ret;
+	calls add what the callee costs. Prints the report if options.budget is
+	set, and reports an error for every .budget the label's worst case
+	goes over (or can't be bounded for).
+*/
+void BUDGET_Check(asm_context& ctx);
+
+#endif
@@ -0,0 +1,302 @@
+#include "build_cache.h"
+#include "error.h"
+#include "assembler.h"
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <thread>
+#include <sstream>
+#include <stdio.h>
+#ifdef _WIN32
+#include <io.h>
+#include <direct.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <utime.h>
+#endif
+
+#define CACHE_MAGIC "CBC1"
+
+struct cache_file {
+	std::string path;
+	long long size;
+	long long mtime;
+};
+
+static unsigned long long HashBytes(unsigned long long hash, const char* data, size_t size) {
+	//64-bit FNV-1a
+	for (size_t i = 0; i < size; i++) {
+		hash ^= (byte)data[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+static unsigned long long HashString(unsigned long long hash, const std::string& str) {
+	unsigned long long size = str.size();
+	hash = HashBytes(hash, (const char*)&size, sizeof(size));
+	return HashBytes(hash, str.data(), str.size());
+}
+
+static bool ReadWholeFile(const std::string& path, std::string& out) {
+	std::ifstream file(path, std::ifstream::binary);
+	if (!file.is_open()) return false;
+	out.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	return true;
+}
+
+static std::string CacheDir(const asm_context& ctx) {
+	std::string dir = ctx.options.cache_dir;
+	if (!dir.empty() && dir.back() != '/' && dir.back() != '\\') dir += '/';
+	return dir;
+}
+
+// Only options that change what gets written belong in the key
+static unsigned long long OptionsHash(unsigned long long hash, const asm_options& options) {
+	hash = HashString(hash, options.relocatable ? "relocatable" : "rom");
+	hash = HashString(hash, options.optimize ? "optimize" : "");
+	hash = HashString(hash, options.outline ? "outline" : "");
+	hash = HashString(hash, options.cost_model);
+	for (const std::string& dir : options.include_paths) hash = HashString(hash, dir);
+	return hash;
+}
+
+static std::string EntryName(const asm_context& ctx, char kind, unsigned long long hash) {
+	char name[32];
+	snprintf(name, sizeof(name), "%c%016llx", kind, hash);
+	return CacheDir(ctx) + name + BUILD_CACHE_EXTENSION;
+}
+
+// Everything but the includes, which aren't known until the source is assembled
+static unsigned long long SourceHash(const asm_context& ctx, const std::string& path, const std::string& source) {
+	unsigned long long hash = 0xCBF29CE484222325ULL;
+	hash = HashString(hash, CBA_VERSION);
+	hash = OptionsHash(hash, ctx.options);
+	hash = HashString(hash, path);
+	return HashString(hash, source);
+}
+
+// Folds every include's path and contents into the source hash. Returns
+// false if one of them can no longer be read.
+static bool ClosureHash(unsigned long long* hash, const std::vector<std::string>& includes) {
+	for (const std::string& include_path : includes) {
+		std::string contents;
+		if (!ReadWholeFile(include_path, contents)) return false;
+		*hash = HashString(*hash, include_path);
+		*hash = HashString(*hash, contents);
+	}
+	return true;
+}
+
+/*****************************************/
+/*										 */
+/*			  ENTRY FORMAT				 */
+/*                                       */
+/*****************************************/
+static void WriteU32(std::string& out, uint value) {
+	for (uint i = 0; i < 4; i++) out += (char)((value >> (i * 8)) & 0xFF);
+}
+static void WriteString(std::string& out, const std::string& str) {
+	WriteU32(out, str.size());
+	out += str;
+}
+
+static bool ReadU32(const std::string& in, size_t& pos, uint* value) {
+	if (pos + 4 > in.size()) return false;
+	*value = 0;
+	for (uint i = 0; i < 4; i++) *value |= (uint)(byte)in[pos++] << (i * 8);
+	return true;
+}
+static bool ReadString(const std::string& in, size_t& pos, std::string& str) {
+	uint size;
+	if (!ReadU32(in, pos, &size) || pos + size > in.size()) return false;
+	str.assign(in, pos, size);
+	pos += size;
+	return true;
+}
+
+/*****************************************/
+/*										 */
+/*			  CACHE DIRECTORY			 */
+/*                                       */
+/*****************************************/
+static std::vector<cache_file> ListEntries(const std::string& dir) {
+	std::vector<cache_file> files;
+#ifdef _WIN32
+	struct _finddata64_t data;
+	intptr_t handle = _findfirst64((dir + "*" BUILD_CACHE_EXTENSION).c_str(), &data);
+	if (handle == -1) return files;
+	do {
+		files.push_back({ dir + data.name, (long long)data.size, (long long)data.time_write });
+	} while (_findnext64(handle, &data) == 0);
+	_findclose(handle);
+#else
+	DIR* handle = opendir(dir.empty() ? "." : dir.c_str());
+	if (handle == nullptr) return files;
+	std::string extension = BUILD_CACHE_EXTENSION;
+	while (struct dirent* entry = readdir(handle)) {
+		std::string name = entry->d_name;
+		if (name.size() <= extension.size() ||
+			name.compare(name.size() - extension.size(), extension.size(), extension) != 0) continue;
+		struct stat info;
+		if (stat((dir + name).c_str(), &info) != 0) continue;
+		files.push_back({ dir + name, (long long)info.st_size, (long long)info.st_mtime });
+	}
+	closedir(handle);
+#endif
+	return files;
+}
+
+static void MakeDirectory(const std::string& dir) {
+	if (dir.empty()) return;
+#ifdef _WIN32
+	_mkdir(dir.c_str());
+#else
+	mkdir(dir.c_str(), 0777);
+#endif
+}
+
+// Entries are evicted oldest first by modification time, so a hit bumps it
+static void TouchEntry(const std::string& path) {
+#ifdef _WIN32
+	_utime(path.c_str(), NULL);
+#else
+	utime(path.c_str(), NULL);
+#endif
+}
+
+static void TrimCache(const asm_context& ctx) {
+	std::vector<cache_file> files = ListEntries(CacheDir(ctx));
+	long long limit = (long long)ctx.options.cache_megabytes * 1024 * 1024;
+	long long total = 0;
+	for (const cache_file& file : files) total += file.size;
+	if (total <= limit) return;
+
+	std::sort(files.begin(), files.end(), [](const cache_file& a, const cache_file& b) {
+		return a.mtime < b.mtime;
+	});
+	for (const cache_file& file : files) {
+		if (total <= limit) break;
+		if (remove(file.path.c_str()) == 0) total -= file.size;
+	}
+}
+
+/*****************************************/
+/*										 */
+/*			  RESTORE / STORE			 */
+/*                                       */
+/*****************************************/
+/*
+	Two kinds of entry share the directory. A manifest ("m" + source hash)
+	lists the files the last build of that source included. A result ("r" +
+	closure hash) holds a finished build. Looking a build up hashes the
+	includes the manifest names as they are now; since a result is keyed by
+	the closure it was actually built from, it can only be found again when
+	every one of those files is unchanged.
+*/
+bool CACHE_Restore(asm_context& ctx, std::string path) {
+	std::string source, manifest;
+	if (!ReadWholeFile(path, source)) return false;
+	unsigned long long hash = SourceHash(ctx, path, source);
+	if (!ReadWholeFile(EntryName(ctx, 'm', hash), manifest)) return false;
+
+	size_t pos = 0;
+	std::string magic;
+	uint include_count;
+	if (!ReadString(manifest, pos, magic) || magic != CACHE_MAGIC ||
+		!ReadU32(manifest, pos, &include_count)) return false;
+	std::vector<std::string> includes(include_count);
+	for (std::string& include_path : includes) {
+		if (!ReadString(manifest, pos, include_path)) return false;
+	}
+	if (!ClosureHash(&hash, includes)) return false;
+
+	std::string entry_path = EntryName(ctx, 'r', hash);
+	std::string in, base_dir, output_name, output;
+	uint message_count;
+	std::list<std::string> messages;
+	if (!ReadWholeFile(entry_path, in)) return false;
+	pos = 0;
+	if (!ReadString(in, pos, magic) || magic != CACHE_MAGIC ||
+		!ReadString(in, pos, base_dir) || !ReadString(in, pos, output_name) ||
+		!ReadString(in, pos, output) || !ReadU32(in, pos, &message_count)) return false;
+	for (uint i = 0; i < message_count; i++) {
+		messages.emplace_back();
+		if (!ReadString(in, pos, messages.back())) return false;
+	}
+	if (pos != in.size()) return false;
+
+	ctx.base_dir = base_dir;
+	ctx.output_name = output_name;
+	ctx.source_files = { path };
+	ctx.source_files.insert(ctx.source_files.end(), includes.begin(), includes.end());
+	ctx.message_list = messages;
+	ctx.rom_index = output.size();
+	ctx.stats.build_cached = true;
+	TouchEntry(EntryName(ctx, 'm', SourceHash(ctx, path, source)));
+	TouchEntry(entry_path);
+
+	std::string output_path = base_dir + output_name;
+	bool written;
+	if (!ASM_WriteOutput(ctx, output_path, output.data(), output.size(), &written))
+		PushError(ctx, "Could not create/open output file: \"%s\"", output_path.c_str());
+	else if (written) PushMessage(ctx, "Restored %i bytes to %s from the build cache.\n", (uint)output.size(), output_path.c_str());
+	else PushMessage(ctx, "%s is unchanged (%i bytes), left as it was.\n", output_path.c_str(), (uint)output.size());
+	if (!ctx.options.relocatable && ctx.error_list.empty()) ASM_PushRemaining(ctx);
+	return true;
+}
+
+// Written under a temporary name and renamed into place, so other processes
+// or batch threads never read half an entry
+static void WriteEntry(const std::string& entry_path, const std::string& contents) {
+	std::ostringstream temp_name;
+	temp_name << entry_path << "." << std::this_thread::get_id() << ".tmp";
+	{
+		std::ofstream entry(temp_name.str(), std::ofstream::binary | std::ofstream::trunc);
+		if (!entry.is_open()) return;
+		entry.write(contents.data(), contents.size());
+	}
+	remove(entry_path.c_str());
+	if (rename(temp_name.str().c_str(), entry_path.c_str()) != 0) remove(temp_name.str().c_str());
+}
+
+void CACHE_Store(const asm_context& ctx, std::string path) {
+	//A failed build can depend on more than its inputs (e.g. an include that
+	//was missing), so only successful ones are kept
+	if (!ctx.error_list.empty()) return;
+	std::string source;
+	if (!ReadWholeFile(path, source)) return;
+	//Read back what was written rather than re-deriving it, so ROMs and
+	//objects are cached the same way
+	std::string output;
+	if (!ReadWholeFile(ctx.base_dir + ctx.output_name, output)) return;
+
+	std::vector<std::string> includes(ctx.source_files.begin() + std::min<size_t>(1, ctx.source_files.size()), ctx.source_files.end());
+	std::sort(includes.begin(), includes.end());
+	includes.erase(std::unique(includes.begin(), includes.end()), includes.end());
+	unsigned long long source_hash = SourceHash(ctx, path, source);
+	unsigned long long closure_hash = source_hash;
+	if (!ClosureHash(&closure_hash, includes)) return;
+
+	std::string manifest;
+	WriteString(manifest, CACHE_MAGIC);
+	WriteU32(manifest, includes.size());
+	for (const std::string& include_path : includes) WriteString(manifest, include_path);
+
+	std::string result;
+	WriteString(result, CACHE_MAGIC);
+	WriteString(result, ctx.base_dir);
+	WriteString(result, ctx.output_name);
+	WriteString(result, output);
+	//Messages about writing the output are made again when it is restored
+	WriteU32(result, ctx.output_messages);
+	auto message = ctx.message_list.begin();
+	for (uint i = 0; i < ctx.output_messages; i++, message++) WriteString(result, *message);
+
+	MakeDirectory(CacheDir(ctx));
+	WriteEntry(EntryName(ctx, 'r', closure_hash), result);
+	WriteEntry(EntryName(ctx, 'm', source_hash), manifest);
+	TrimCache(ctx);
+}
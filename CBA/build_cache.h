@@ -0,0 +1,25 @@
+#ifndef CBA_BUILD_CACHE_H
+#define CBA_BUILD_CACHE_H
+#pragma once
+#include "stdafx.h"
+#include "context.h"
+
+#define BUILD_CACHE_EXTENSION ".cbc"
+
+/*
+	Finished builds stored on disk under a hash of everything that decides
+	their output: CBA_VERSION, the options that change the output, the
+	source path and bytes, and the path and bytes of every file it included.
+	Entries hold the output file's bytes and the build's messages, so a hit
+	replays the build without assembling anything. Once the directory grows
+	past its size cap, the least recently used entries go.
+*/
+
+// Restores a cached build of path into ctx and rewrites its output file.
+// Returns false on a miss, leaving ctx untouched.
+bool CACHE_Restore(asm_context& ctx, std::string path);
+
+// Stores the build just made from path, then trims the cache to size
+void CACHE_Store(const asm_context& ctx, std::string path);
+
+#endif
@@ -0,0 +1,245 @@
+#include "cfg.h"
+#include <algorithm>
+#include <fstream>
+#include <stdio.h>
+
+#define OP_TOP(op) ((op) >> 12)
+#define OP_X(op)   (((op) >> 8) & 0xF)
+#define OP_Y(op)   (((op) >> 4) & 0xF)
+#define OP_N(op)   ((op) & 0xF)
+#define OP_NN(op)  ((op) & 0xFF)
+#define OP_NNN(op) ((op) & 0xFFF)
+
+static bool IsSkip(word op) {
+	switch (OP_TOP(op)) {
+	case 0x3: case 0x4: case 0x5: case 0x9: return true;
+	case 0xE: return OP_NN(op) == 0x9E || OP_NN(op) == 0xA1;
+	}
+	return false;
+}
+
+// Does execution carry on to the next instruction?
+static bool FallsThrough(word op) {
+	return OP_TOP(op) != 0x1 && OP_TOP(op) != 0xB && op != 0x00EE;
+}
+
+int CFG_NodeAt(const cfg_graph& graph, uint offset) {
+	auto found = std::lower_bound(graph.nodes.begin(), graph.nodes.end(), offset,
+								  [](const cfg_node& node, uint o) { return node.offset < o; });
+	if (found == graph.nodes.end() || found->offset != offset) return -1;
+	return (int)(found - graph.nodes.begin());
+}
+
+void CFG_Build(cfg_graph& graph) {
+	uint count = (uint)graph.nodes.size();
+	std::vector<bool> leader(count + 2, false);
+	leader[0] = true;
+	for (uint i = 0; i < count; i++) {
+		const cfg_node& node = graph.nodes[i];
+		if (i > 0 && node.code != graph.nodes[i - 1].code) leader[i] = true;
+		if (!node.code) continue;
+		uint top = OP_TOP(node.op);
+		if (top == 0x1 || top == 0x2 || top == 0xB || node.op == 0x00EE) leader[i + 1] = true;
+		if (IsSkip(node.op)) leader[i + 1] = leader[i + 2] = true;
+		if (node.target >= 0) {
+			int target = CFG_NodeAt(graph, node.target);
+			if (target >= 0) {
+				for (uint k = 0; k < std::max(node.entries, 1u) && target + k < count; k++) leader[target + k] = true;
+			}
+		}
+	}
+
+	graph.blocks.clear();
+	graph.block_of.assign(count, 0);
+	for (uint i = 0; i < count; i++) {
+		if (leader[i]) graph.blocks.push_back({ i, 0, graph.nodes[i].code, false, {} });
+		graph.blocks.back().count++;
+		graph.block_of[i] = (uint)graph.blocks.size() - 1;
+	}
+
+	for (cfg_block& block : graph.blocks) {
+		if (!block.code) continue;
+		uint last = block.first + block.count - 1;
+		const cfg_node& node = graph.nodes[last];
+		int target = (node.target >= 0) ? CFG_NodeAt(graph, node.target) : -1;
+		if (target >= 0 && node.entries > 0) {
+			for (uint k = 0; k < node.entries && target + k < count; k++)
+				block.successors.push_back({ graph.block_of[target + k], CFG_EDGE_TABLE });
+		}
+		else if (target >= 0) {
+			uint kind = CFG_EDGE_JUMP;
+			if (OP_TOP(node.op) == 0x2) kind = CFG_EDGE_CALL;
+			else if (OP_TOP(node.op) == 0xB) kind = CFG_EDGE_TABLE;
+			block.successors.push_back({ graph.block_of[target], kind });
+		}
+		if (FallsThrough(node.op) && last + 1 < count)
+			block.successors.push_back({ graph.block_of[last + 1], CFG_EDGE_FALL });
+		if (IsSkip(node.op) && last + 2 < count)
+			block.successors.push_back({ graph.block_of[last + 2], CFG_EDGE_FALL });
+	}
+}
+
+void CFG_MarkReachable(cfg_graph& graph, const std::vector<uint>& roots) {
+	for (cfg_block& block : graph.blocks) block.reachable = false;
+	std::vector<uint> pending;
+	for (uint offset : roots) {
+		int node = CFG_NodeAt(graph, offset);
+		if (node >= 0) pending.push_back(graph.block_of[node]);
+	}
+	while (!pending.empty()) {
+		cfg_block& block = graph.blocks[pending.back()];
+		pending.pop_back();
+		if (block.reachable) continue;
+		block.reachable = true;
+		for (const cfg_edge& edge : block.successors) pending.push_back(edge.block);
+		//A jp v0 table not made by .switch is only known by its base, so assume it runs on from there
+		const cfg_node& last = graph.nodes[block.first + block.count - 1];
+		if (block.code && OP_TOP(last.op) == 0xB && last.entries == 0) {
+			for (uint b = graph.block_of[block.first] + 1; b < graph.blocks.size(); b++) pending.push_back(b);
+		}
+	}
+}
+
+void CFG_FromRom(const asm_context& ctx, cfg_graph& graph) {
+	graph.nodes.clear();
+	auto table = ctx.jump_tables.begin();
+	for (const emitted_block& block : ctx.emitted) {
+		cfg_node node = { block.offset, block.size, block.code && block.size == INSTRUCTION_SIZE, 0, -1, 0 };
+		while (table != ctx.jump_tables.end() && table->offset < block.offset) table++;
+		if (table != ctx.jump_tables.end() && table->offset == block.offset) node.entries = table->entries;
+		if (node.code) {
+			node.op = ((byte)ctx.rom_output[block.offset] << 8) | (byte)ctx.rom_output[block.offset + 1];
+			uint top = OP_TOP(node.op);
+			if ((top == 0x1 || top == 0x2 || top == 0xB) && OP_NNN(node.op) >= CHIP8_MEMSTART)
+				node.target = OP_NNN(node.op) - CHIP8_MEMSTART;
+		}
+		graph.nodes.push_back(node);
+	}
+	CFG_Build(graph);
+}
+
+/*****************************************/
+/*										 */
+/*				  OUTPUT				 */
+/*                                       */
+/*****************************************/
+static std::string Address(const std::map<uint, std::string>& labels, uint address) {
+	auto found = labels.find(address);
+	if (found != labels.end()) return found->second;
+	char text[16];
+	snprintf(text, sizeof(text), "0x%03X", address);
+	return text;
+}
+
+static std::string Disassemble(const std::map<uint, std::string>& labels, word op) {
+	char text[64];
+	uint x = OP_X(op), y = OP_Y(op), nn = OP_NN(op);
+	std::string nnn = Address(labels, OP_NNN(op));
+	switch (OP_TOP(op)) {
+	case 0x0:
+		if (op == 0x00E0) return "cls";
+		if (op == 0x00EE) return "ret";
+		snprintf(text, sizeof(text), "sys 0x%03X", OP_NNN(op));
+		break;
+	case 0x1: return "jp " + nnn;
+	case 0x2: return "call " + nnn;
+	case 0x3: snprintf(text, sizeof(text), "se v%X 0x%02X", x, nn); break;
+	case 0x4: snprintf(text, sizeof(text), "sne v%X 0x%02X", x, nn); break;
+	case 0x5: snprintf(text, sizeof(text), "se v%X v%X", x, y); break;
+	case 0x6: snprintf(text, sizeof(text), "ld v%X 0x%02X", x, nn); break;
+	case 0x7: snprintf(text, sizeof(text), "add v%X 0x%02X", x, nn); break;
+	case 0x8: {
+		static const char* alu[16] = { "ld", "or", "and", "xor", "add", "sub", "shr", "subn",
+									   nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "shl", nullptr };
+		if (alu[OP_N(op)] == nullptr) snprintf(text, sizeof(text), "dw 0x%04X", op);
+		else snprintf(text, sizeof(text), "%s v%X v%X", alu[OP_N(op)], x, y);
+		break;
+	}
+	case 0x9: snprintf(text, sizeof(text), "sne v%X v%X", x, y); break;
+	case 0xA: return "ld i " + nnn;
+	case 0xB: return "jp v0 " + nnn;
+	case 0xC: snprintf(text, sizeof(text), "rand v%X 0x%02X", x, nn); break;
+	case 0xD: snprintf(text, sizeof(text), "draw v%X v%X %i", x, y, OP_N(op)); break;
+	case 0xE:
+		if (nn == 0x9E) snprintf(text, sizeof(text), "skp v%X", x);
+		else if (nn == 0xA1) snprintf(text, sizeof(text), "sknp v%X", x);
+		else snprintf(text, sizeof(text), "dw 0x%04X", op);
+		break;
+	case 0xF:
+		switch (nn) {
+		case 0x07: snprintf(text, sizeof(text), "ld v%X dt", x); break;
+		case 0x0A: snprintf(text, sizeof(text), "wkp v%X", x); break;
+		case 0x15: snprintf(text, sizeof(text), "ld dt v%X", x); break;
+		case 0x18: snprintf(text, sizeof(text), "ld st v%X", x); break;
+		case 0x1E: snprintf(text, sizeof(text), "add i v%X", x); break;
+		case 0x29: snprintf(text, sizeof(text), "fnt v%X", x); break;
+		case 0x33: snprintf(text, sizeof(text), "bcd v%X", x); break;
+		case 0x55: snprintf(text, sizeof(text), "ld i v%X", x); break;
+		case 0x65: snprintf(text, sizeof(text), "ld v%X i", x); break;
+		default:   snprintf(text, sizeof(text), "dw 0x%04X", op); break;
+		}
+		break;
+	}
+	return text;
+}
+
+static std::string DotEscape(const std::string& text) {
+	std::string result;
+	for (char c : text) {
+		if (c == '"' || c == '\\') result += '\\';
+		result += c;
+	}
+	return result;
+}
+
+bool CFG_WriteDot(const asm_context& ctx, const cfg_graph& graph, std::string path) {
+	std::ofstream file(path, std::ofstream::binary | std::ofstream::trunc);
+	if (!file.is_open()) return false;
+	//The first label defined at an address names it
+	std::map<uint, std::string> labels;
+	for (const symbol* sym : ctx.symbols.records) {
+		if (sym->kind == SYMBOL_LABEL) labels.emplace(sym->value, std::string(sym->name));
+	}
+
+	file << "digraph \"" << DotEscape(ctx.output_name) << "\" {\n";
+	file << "\tnode [shape=box, fontname=\"monospace\"];\n";
+	char line[96];
+	for (uint b = 0; b < graph.blocks.size(); b++) {
+		const cfg_block& block = graph.blocks[b];
+		const cfg_node& first = graph.nodes[block.first];
+		const cfg_node& last = graph.nodes[block.first + block.count - 1];
+		uint address = CHIP8_MEMSTART + first.offset;
+		std::string text = Address(labels, address);
+		snprintf(line, sizeof(line), " (0x%03X-0x%03X)\\l", address, CHIP8_MEMSTART + last.offset + last.size - 1);
+		text += line;
+		if (block.code) {
+			for (uint n = block.first; n < block.first + block.count; n++) {
+				const cfg_node& node = graph.nodes[n];
+				snprintf(line, sizeof(line), "%03X  %04X  ", CHIP8_MEMSTART + node.offset, node.op);
+				text += line + Disassemble(labels, node.op) + "\\l";
+			}
+		}
+		else {
+			snprintf(line, sizeof(line), "data, %u bytes\\l", last.offset + last.size - first.offset);
+			text += line;
+		}
+		//Label names are identifiers (with an '@' if generated), so only the graph name needs escaping
+		file << "\tb" << b << " [label=\"" << text << "\"";
+		if (!block.code) file << ", shape=folder";
+		if (block.code && !block.reachable) file << ", style=filled, fillcolor=lightgray";
+		file << "];\n";
+	}
+	for (uint b = 0; b < graph.blocks.size(); b++) {
+		for (const cfg_edge& edge : graph.blocks[b].successors) {
+			file << "\tb" << b << " -> b" << edge.block;
+			switch (edge.kind) {
+			case CFG_EDGE_FALL:  file << " [style=dashed]"; break;
+			case CFG_EDGE_CALL:  file << " [color=blue, label=\"call\"]"; break;
+			case CFG_EDGE_TABLE: file << " [style=dotted, label=\"v0+\"]"; break;
+			}
+			file << ";\n";
+		}
+	}
+	file << "}\n";
+	return file.good();
+}
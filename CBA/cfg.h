@@ -0,0 +1,65 @@
+#ifndef CBA_CFG_H
+#define CBA_CFG_H
+#pragma once
+#include "stdafx.h"
+#include "context.h"
+
+#define CFG_EXTENSION ".dot"
+
+#define CFG_EDGE_FALL 0x00	/* Falls through, or is skipped to */
+#define CFG_EDGE_JUMP 0x01
+#define CFG_EDGE_CALL 0x02
+#define CFG_EDGE_TABLE 0x03	/* jp v0: each entry of a known table, else the base */
+
+// One instruction, or one line of data
+struct cfg_node {
+	uint offset;
+	uint size;
+	bool code;
+	word op;
+	int target;		/* ROM offset a jp/call/jp v0 goes to, -1 if unknown */
+	uint entries;	/* Instructions in a .switch table a jp v0 indexes, 0 if unknown */
+};
+
+struct cfg_edge {
+	uint block;
+	uint kind;
+};
+
+struct cfg_block {
+	uint first;		/* Node range */
+	uint count;
+	bool code;
+	bool reachable;
+	std::vector<cfg_edge> successors;
+};
+
+/*
+	Basic blocks over an assembled image. A block ends at a jp, call, ret or
+	skip, or where a jump lands. Skips have two successors: the next
+	instruction and the one after it. A jp v0 with a known table has an
+	edge to every entry. Consecutive data lines form data blocks,
+	which only have edges into them (code falling into data).
+*/
+struct cfg_graph {
+	std::vector<cfg_node> nodes;
+	std::vector<cfg_block> blocks;
+	std::vector<uint> block_of;	/* Node index -> block index */
+};
+
+// Splits graph.nodes (sorted, contiguous) into blocks and links them
+void CFG_Build(cfg_graph& graph);
+
+// Index of the node starting at offset, or -1
+int CFG_NodeAt(const cfg_graph& graph, uint offset);
+
+// Marks every block reachable from the nodes at the given offsets
+void CFG_MarkReachable(cfg_graph& graph, const std::vector<uint>& roots);
+
+// Builds the graph of a finished ROM from ctx.emitted and the patched bytes
+void CFG_FromRom(const asm_context& ctx, cfg_graph& graph);
+
+// Writes the graph as Graphviz, one box per block listing its instructions
+bool CFG_WriteDot(const asm_context& ctx, const cfg_graph& graph, std::string path);
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef CBA_CONTEXT_H
+#define CBA_CONTEXT_H
+#pragma once
+#include "stdafx.h"
+#include "lexer.h"
+#include "include_cache.h"
+#include "symbol.h"
+#include "stats.h"
+
+#define FIXUP_NNN 0x00
+
+#define BUILD_CACHE_DEFAULT_MB 64
+
+// A field in rom_output waiting on a label that had not been defined yet
+struct fixup {
+	uint offset;
+	uint kind;
+	symbol* target;
+	uint file;
+	uint line;
+};
+
+struct asm_error {
+	std::string file;
+	uint line;
+	std::string message;
+};
+
+struct asm_options {
+	bool print_stats = false;
+	std::string stats_json;
+	bool watch = false;		/* Record what --watch needs to reassemble incrementally */
+	bool relocatable = false;	/* Write an object for the linker instead of a ROM */
+	std::string cache_dir;		/* Build cache directory, empty for no cache */
+	uint cache_megabytes = BUILD_CACHE_DEFAULT_MB;
+	bool write_if_changed = false;	/* Leave outputs that already hold the same bytes alone */
+	bool depfile = false;			/* Write a make-style .d file next to the output */
+	std::vector<std::string> include_paths;	/* Searched in order after the source's own directory */
+	bool optimize = false;		/* Run the peephole optimizer before the second pass */
+	bool dump_cfg = false;		/* Write the ROM's basic-block graph next to it */
+	bool outline = false;		/* Also move repeated code into subroutines (-Os) */
+	bool budget = false;		/* Report every label's best and worst case cycles */
+	std::string cost_model;		/* key=value,... over the default cycle costs */
+	bool in_memory = false;		/* Leave the ROM or object in rom_output rather than writing it */
+};
+
+// A routine's cycle limit from .budget, checked by BUDGET_Check
+struct budget_decl {
+	symbol* label;
+	uint cycles;
+	uint file;
+	uint line;
+};
+
+// A jp v0 emitted by .switch, followed straight away by its jp entries
+struct jump_table {
+	uint offset;	/* Of the jp v0 */
+	uint entries;
+};
+
+// The bytes one source line emitted, recorded for the optimizer and analyses
+struct emitted_block {
+	uint offset;
+	uint size;
+	bool code;		/* An instruction, rather than dw/db/dbs data */
+	uint file;
+	uint line;
+};
+
+// A file the first pass is part way through, and the line it is on
+struct pass_frame {
+	std::shared_ptr<const lexed_file> file;
+	uint line;
+};
+
+// A symbol as it was before the first pass (re)defined it
+struct symbol_change {
+	symbol* target;
+	symbol previous;
+};
+
+/*
+	The assembler's state as the first pass reached an .include. Watch mode
+	rolls back to the mark of the first changed file and carries on from
+	there, rather than reassembling everything before it.
+*/
+struct layout_mark {
+	std::vector<pass_frame> frames;		/* Outermost first; the last is on the .include */
+	std::vector<uint> file_trace;
+	uint source_file;					/* Index the included file will take in source_files */
+	uint rom_index;
+	uint byte_overflow;
+	uint fixups;
+	uint budgets;
+	uint journal;
+	uint errors;
+	uint stats_files;
+	uint stats_lines;
+	uint stats_tokens;
+};
+
+/*
+	All of the state needed to assemble one ROM. Nothing in here is shared
+	between contexts, so separate ROMs can be assembled on separate threads.
+*/
+struct asm_context {
+	asm_options options;
+	asm_stats stats;
+
+	std::string base_dir;
+	std::string output_name;
+	std::vector<std::string> source_files;
+	std::vector<uint> file_trace;
+	std::shared_ptr<include_cache> includes;
+	uint line_number = 1;
+
+	char rom_output[ROM_STAGING_SIZE] = { 0 };
+	uint rom_index = 0;
+	uint byte_overflow = 0;
+
+	symbol_table symbols;
+	std::vector<fixup> fixups;
+	std::vector<emitted_block> emitted;
+	std::vector<budget_decl> budgets;
+	std::vector<jump_table> jump_tables;
+
+	std::shared_ptr<const lexed_file> source;
+	std::vector<pass_frame> frames;
+	std::vector<layout_mark> marks;
+	std::vector<symbol_change> journal;
+
+	std::list<asm_error> error_list;
+	std::list<std::string> message_list;
+	uint output_messages = 0;	/* Messages pushed before the output was written */
+};
+
+#endif
@@ -1,28 +1,28 @@
 #include "enforce.h"
 #include "opcode.h"
 
-bool EnforceType(token tkn, uint type) {
+bool EnforceType(asm_context& ctx, const token& tkn, uint type) {
 	if (tkn.type == type) return true;
-	PushError("Expected type %s, found %s.", type_names[type], type_names[tkn.type]);
+	PushError(ctx, "Expected type %s, found %s.", type_names[type], type_names[tkn.type]);
 	return false;
 }
-bool EnforceRegister(token tkn, uint reg) {
+bool EnforceRegister(asm_context& ctx, const token& tkn, uint reg) {
 	if (tkn.value == reg) return true;
-	PushError("Expected register %s, found %s.", reg_names[reg], reg_names[tkn.value]);
+	PushError(ctx, "Expected register %s, found %s.", reg_names[reg], reg_names[tkn.value]);
 	return false;
 }
-bool EnforceRegisterV(token tkn) {
+bool EnforceRegisterV(asm_context& ctx, const token& tkn) {
 	if (tkn.value <= VF) return true;
-	PushError("Expected register V[0-F], found %s.", reg_names[tkn.value]);
+	PushError(ctx, "Expected register V[0-F], found %s.", reg_names[tkn.value]);
 	return false;
 }
-bool EnforceBitcount(token tkn, uint bits) {
+bool EnforceBitcount(asm_context& ctx, const token& tkn, uint bits) {
 	if (tkn.bitcount <= bits) return true;
-	PushError("Expected %i-bit literal, found %i-bit literal.", bits, tkn.bitcount);
+	PushError(ctx, "Expected %i-bit literal, found %i-bit literal.", bits, tkn.bitcount);
 	return false;
 }
-bool EnforceBitcountEx(token tkn, uint bits) {
+bool EnforceBitcountEx(asm_context& ctx, const token& tkn, uint bits) {
 	if (tkn.bitcount == bits) return true;
-	PushError("Expected %i-bit literal, found %i-bit literal.", bits, tkn.bitcount);
+	PushError(ctx, "Expected %i-bit literal, found %i-bit literal.", bits, tkn.bitcount);
 	return false;
 }
\ No newline at end of file
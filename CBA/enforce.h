@@ -5,9 +5,9 @@
 #include "error.h"
 struct token;
 struct opcode;
-bool EnforceType(token tkn, uint type);
-bool EnforceRegister(token tkn, uint reg);
-bool EnforceRegisterV(token tkn);
-bool EnforceBitcount(token tkn, uint bits);
-bool EnforceBitcountEx(token tkn, uint bits);
-#endif
\ No newline at end of file
+bool EnforceType(asm_context& ctx, const token& tkn, uint type);
+bool EnforceRegister(asm_context& ctx, const token& tkn, uint reg);
+bool EnforceRegisterV(asm_context& ctx, const token& tkn);
+bool EnforceBitcount(asm_context& ctx, const token& tkn, uint bits);
+bool EnforceBitcountEx(asm_context& ctx, const token& tkn, uint bits);
+#endif
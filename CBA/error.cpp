@@ -1,63 +1,72 @@
 #include "error.h"
 #include "assembler.h"
+#include "opcode.h"
 #include <sstream>
 
-uint format_width;
-std::string error_file;
-
-static bool hold_error = false;
-static std::string held_error;
-
-std::list<std::string> error_list;
-
 const char* type_names[] = {
 	"literal", "register",
 };
-const char* reg_names[] = {
-	"v0", "v1", "v2", "v3",
-	"v4", "v5", "v6", "v7",
-	"v8", "v9", "va", "vb",
-	"vc", "vd", "ve", "vf",
-	"i", "dt", "st"
-};
-
-void HoldNextError() {
-	hold_error = true;
-	held_error.clear();
-}
-void CommitHeldError() {
-	hold_error = false;
-	error_list.push_back(held_error);
-}
+#define X(a, b) #b,
+const char* reg_names[] = { CORE_REGISTERS };
+#undef X
 
-std::string GetErrorLocation() {
-	char buffer[256] = { 0 };
-	if (error_file != file_trace.back()) {
-		error_file = file_trace.back();
-		sprintf_s(buffer, "\n(%s)\n", error_file.c_str());
+// Errors raised outside of any source file (e.g. while writing the ROM) carry no location
+void PushError(asm_context& ctx, const char* fmt, ...) {
+	va_list args;
+	char buffer[512];
+	va_start(args, fmt);
+	uint len = vsprintf_s(buffer, fmt, args);
+	va_end(args);
+	asm_error error = { "", 0, std::string(buffer) };
+	if (!ctx.file_trace.empty()) {
+		error.file = ctx.source_files[ctx.file_trace.back()];
+		error.line = ctx.line_number;
 	}
-	uint len = strlen(buffer);
-	sprintf_s(buffer + len, 256 - len, "   Line %*i: ", format_width, line_number);
-	return std::string(buffer);
+	ctx.error_list.push_back(error);
 }
 
-void PushError(const char* fmt, ...) {
+void PushMessage(asm_context& ctx, const char* fmt, ...) {
 	va_list args;
 	char buffer[512];
 	va_start(args, fmt);
-	uint len = vsprintf_s(buffer, fmt, args);
+	vsprintf_s(buffer, fmt, args);
 	va_end(args);
-	std::string complete_error = GetErrorLocation() + std::string(buffer) + "\n";
+	ctx.message_list.push_back(std::string(buffer));
+}
+
+void PrintAllMessages(const asm_context& ctx, FILE* out) {
+	for (const auto& msg : ctx.message_list) {
+		fprintf(out, "%s", msg.c_str());
+	}
+}
 
-	if (hold_error && held_error.empty()) {
-		held_error = complete_error;
+static uint DigitCount(uint value) {
+	uint digits = 1;
+	while (value >= 10) {
+		value /= 10;
+		digits++;
 	}
-	else error_list.push_back(complete_error);
+	return digits;
 }
 
-void PrintAllErrors() {
-	for (const auto& err : error_list) {
-		printf(err.c_str());
+void PrintAllErrors(const asm_context& ctx, FILE* out) {
+	uint max_line = 0;
+	for (const auto& err : ctx.error_list) {
+		if (err.line > max_line) max_line = err.line;
 	}
-	printf("\nTotal Errors: %i\n", error_list.size());
-}
\ No newline at end of file
+	uint format_width = DigitCount(max_line);
+
+	const std::string* error_file = nullptr;
+	for (const auto& err : ctx.error_list) {
+		if (err.file.empty()) {
+			fprintf(out, "%s\n", err.message.c_str());
+			continue;
+		}
+		if (error_file == nullptr || *error_file != err.file) {
+			error_file = &err.file;
+			fprintf(out, "\n(%s)\n", error_file->c_str());
+		}
+		fprintf(out, "   Line %*i: %s\n", format_width, err.line, err.message.c_str());
+	}
+	fprintf(out, "\nTotal Errors: %i\n", (uint)ctx.error_list.size());
+}
@@ -2,15 +2,16 @@
 #define CBA_ERROR_H
 #pragma once
 #include "stdafx.h"
+#include "context.h"
 #include <stdarg.h>
-
-extern uint format_width;
-extern std::list<std::string> error_list;
+#include <stdio.h>
 
 extern const char* type_names[];
 extern const char* reg_names[];
 
-void PushError(const char* fmt, ...);
-void PrintAllErrors();
+void PushError(asm_context& ctx, const char* fmt, ...);
+void PushMessage(asm_context& ctx, const char* fmt, ...);
+void PrintAllMessages(const asm_context& ctx, FILE* out = stdout);
+void PrintAllErrors(const asm_context& ctx, FILE* out = stdout);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,65 @@
+#include "include_cache.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+#include <stdlib.h>
+#include <limits.h>
+
+static std::string CanonicalPath(const std::string& path) {
+#ifdef _WIN32
+	char buffer[_MAX_PATH];
+	if (_fullpath(buffer, path.c_str(), _MAX_PATH) == NULL) return path;
+#else
+	char buffer[PATH_MAX];
+	if (realpath(path.c_str(), buffer) == NULL) return path;
+#endif
+	return std::string(buffer);
+}
+
+bool INCLUDE_FileStamp(const std::string& path, long long* mtime, long long* size) {
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &info)) return false;
+	*mtime = ((long long)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+	*size = ((long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+#else
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0) return false;
+	*mtime = (long long)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+	*size = (long long)info.st_size;
+#endif
+	return true;
+}
+
+// Returns nullptr if the file could not be opened. Time spent reading and
+// lexing is added to stats.
+std::shared_ptr<const lexed_file> INCLUDE_Load(include_cache& cache, std::string path, asm_stats& stats, bool* cached) {
+	*cached = false;
+	std::string key = CanonicalPath(path);
+	long long mtime, size;
+	if (!INCLUDE_FileStamp(key, &mtime, &size)) return nullptr;
+	{
+		std::lock_guard<std::mutex> guard(cache.lock);
+		auto it = cache.entries.find(key);
+		if (it != cache.entries.end() && it->second.mtime == mtime && it->second.size == size) {
+			*cached = true;
+			return it->second.file;
+		}
+	}
+
+	//Lex outside of the lock; if two threads race on the same file the
+	//last one to finish simply replaces the other's (identical) entry.
+	std::shared_ptr<lexed_file> file = std::make_shared<lexed_file>();
+	stopwatch timer = STATS_Start();
+	if (!LEX_ReadFile(key, file->source)) return nullptr;
+	stats.read_seconds += STATS_Seconds(timer);
+	timer = STATS_Start();
+	LEX_Tokenize(*file);
+	stats.lex_seconds += STATS_Seconds(timer);
+
+	std::lock_guard<std::mutex> guard(cache.lock);
+	cache.entries[key] = { mtime, size, file };
+	return file;
+}
@@ -0,0 +1,32 @@
+#ifndef CBA_INCLUDE_CACHE_H
+#define CBA_INCLUDE_CACHE_H
+#pragma once
+#include "stdafx.h"
+#include "lexer.h"
+#include "stats.h"
+#include <memory>
+#include <mutex>
+
+struct include_entry {
+	long long mtime;
+	long long size;
+	std::shared_ptr<const lexed_file> file;
+};
+
+/*
+	Lexed .include files keyed by canonical path. An entry is reused for as
+	long as the file's modification time and size stay the same, so a file
+	included many times (by one ROM or by every ROM in a batch) is only read
+	and tokenized once. Safe to share between threads.
+*/
+struct include_cache {
+	std::mutex lock;
+	std::map<std::string, include_entry> entries;
+};
+
+// Last write time (at the finest resolution the platform gives) and size.
+// Returns false if the file does not exist.
+bool INCLUDE_FileStamp(const std::string& path, long long* mtime, long long* size);
+std::shared_ptr<const lexed_file> INCLUDE_Load(include_cache& cache, std::string path, asm_stats& stats, bool* cached);
+
+#endif
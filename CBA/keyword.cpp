@@ -0,0 +1,81 @@
+#include "keyword.h"
+#include "opcode.h"
+#include "lexer.h"
+
+static constexpr keyword keyword_list[] = {
+#define X(a, x, y) { #a, sizeof(#a) - 1, KEYWORD_OPCODE, OP_##a },
+	CORE_OPCODES
+#undef X
+#define X(a, b) { #b, sizeof(#b) - 1, KEYWORD_REGISTER, a },
+	CORE_REGISTERS
+#undef X
+#define X(a) { "." #a, sizeof("." #a) - 1, KEYWORD_DIRECTIVE, DIR_##a },
+	CORE_DIRECTIVES
+#undef X
+};
+
+static constexpr uint KEYWORD_COUNT = sizeof(keyword_list) / sizeof(keyword);
+static constexpr uint KEYWORD_SLOTS = 256;
+static_assert(KEYWORD_COUNT < 0xFF, "Keyword slots are stored as bytes");
+
+/*
+	The table is built at compile time: the first seed that sends every
+	keyword to its own slot is picked, so a lookup is one hash, one probe
+	and one string compare to reject non-keywords.
+*/
+static constexpr char FoldCase(char c) {
+	return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+static constexpr uint HashKeyword(const char* str, size_t len, uint seed) {
+	uint hash = 2166136261u ^ seed;
+	for (size_t i = 0; i < len; i++)
+		hash = (hash ^ (byte)FoldCase(str[i])) * 16777619u;
+	return (hash ^ (hash >> 16)) & (KEYWORD_SLOTS - 1);
+}
+
+static constexpr bool IsPerfectSeed(uint seed) {
+	bool used[KEYWORD_SLOTS] = {};
+	for (uint i = 0; i < KEYWORD_COUNT; i++) {
+		uint slot = HashKeyword(keyword_list[i].name, keyword_list[i].length, seed);
+		if (used[slot]) return false;
+		used[slot] = true;
+	}
+	return true;
+}
+
+static constexpr uint FindPerfectSeed() {
+	uint seed = 0;
+	while (!IsPerfectSeed(seed)) seed++;
+	return seed;
+}
+
+static constexpr uint MaxKeywordLength() {
+	uint result = 0;
+	for (uint i = 0; i < KEYWORD_COUNT; i++)
+		if (keyword_list[i].length > result) result = keyword_list[i].length;
+	return result;
+}
+
+struct keyword_table {
+	byte slots[KEYWORD_SLOTS];
+};
+
+static constexpr keyword_table BuildKeywordTable(uint seed) {
+	keyword_table table = {};
+	for (uint i = 0; i < KEYWORD_COUNT; i++)
+		table.slots[HashKeyword(keyword_list[i].name, keyword_list[i].length, seed)] = i + 1;
+	return table;
+}
+
+static constexpr uint keyword_seed = FindPerfectSeed();
+static constexpr uint keyword_max_length = MaxKeywordLength();
+static constexpr keyword_table keyword_slots = BuildKeywordTable(keyword_seed);
+
+const keyword* FindKeyword(std::string_view str) {
+	if (str.empty() || str.size() > keyword_max_length) return nullptr;
+	byte slot = keyword_slots.slots[HashKeyword(str.data(), str.size(), keyword_seed)];
+	if (slot == 0) return nullptr;
+	const keyword& kw = keyword_list[slot - 1];
+	return NoCaseEquals(str, std::string_view(kw.name, kw.length)) ? &kw : nullptr;
+}
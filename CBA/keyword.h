@@ -0,0 +1,40 @@
+#ifndef CBA_KEYWORD_H
+#define CBA_KEYWORD_H
+#pragma once
+#include "stdafx.h"
+#include <string_view>
+
+#define KEYWORD_OPCODE    0x00
+#define KEYWORD_REGISTER  0x01
+#define KEYWORD_DIRECTIVE 0x02
+
+#define CORE_DIRECTIVES \
+	X(alias  )\
+	X(include)\
+	X(budget )\
+	X(switch )\
+	X(table  )
+
+#define X(a) DIR_##a,
+enum DirectiveValues {
+	CORE_DIRECTIVES
+	DIRECTIVE_COUNT
+};
+#undef X
+
+/*
+	Every reserved word: the opcode mnemonics, register names and directives.
+	id is an OpcodeValues, RegisterValues or DirectiveValues depending on kind.
+*/
+struct keyword {
+	const char* name;
+	uint length;
+	uint kind;
+	uint id;
+};
+
+// Classifies a token with a single perfect-hash probe. Case-insensitive.
+// Returns nullptr if the token is not a keyword.
+const keyword* FindKeyword(std::string_view str);
+
+#endif
@@ -0,0 +1,75 @@
+#include "lexer.h"
+#include <fstream>
+
+static inline bool IsSeperator(char c) {
+	return c == ' ' || c == ',' || c == '\t' || c == '\r';
+}
+
+static inline char FoldCase(char c) {
+	return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+bool LEX_ReadFile(std::string path, std::string& buffer) {
+	std::ifstream file(path, std::ifstream::binary | std::ifstream::ate);
+	if (!file.is_open()) return false;
+	std::streamoff size = file.tellg();
+	file.seekg(0, std::ifstream::beg);
+	buffer.resize((size_t)size);
+	if (size > 0) file.read(&buffer[0], size);
+	return true;
+}
+
+void LEX_Begin(lexer& lex, const std::string& buffer) {
+	lex.begin = buffer.data();
+	lex.cursor = lex.begin;
+	lex.end = lex.begin + buffer.size();
+	lex.line_number = 0;
+}
+
+// Splits the next line into tokens, dropping everything from a comment onwards.
+// Returns false once the end of the buffer has been reached.
+bool LEX_NextLine(lexer& lex, std::vector<lex_token>& tokens) {
+	tokens.clear();
+	if (lex.cursor >= lex.end) return false;
+	lex.line_number++;
+
+	const char* c = lex.cursor;
+	while (c < lex.end && *c != '\n') {
+		if (IsSeperator(*c)) {
+			c++;
+			continue;
+		}
+		if (*c == COMMENT_SYM) {
+			while (c < lex.end && *c != '\n') c++;
+			break;
+		}
+		const char* start = c;
+		while (c < lex.end && *c != '\n' && !IsSeperator(*c)) c++;
+		tokens.push_back({ std::string_view(start, c - start), (uint)(start - lex.begin) });
+	}
+	lex.cursor = (c < lex.end) ? c + 1 : c;
+	return true;
+}
+
+// Tokenizes file.source in place. The tokens point into file.source, so the
+// lexed_file must not be copied or moved afterwards.
+void LEX_Tokenize(lexed_file& file) {
+	file.tokens.clear();
+	file.lines.clear();
+	lexer lex;
+	LEX_Begin(lex, file.source);
+	std::vector<lex_token> line_tokens;
+	while (LEX_NextLine(lex, line_tokens)) {
+		if (line_tokens.empty()) continue;
+		file.lines.push_back({ lex.line_number, (uint)file.tokens.size(), (uint)line_tokens.size() });
+		file.tokens.insert(file.tokens.end(), line_tokens.begin(), line_tokens.end());
+	}
+	file.line_count = lex.line_number;
+}
+
+bool NoCaseEquals(std::string_view a, std::string_view b) {
+	if (a.size() != b.size()) return false;
+	for (size_t i = 0; i < a.size(); i++)
+		if (FoldCase(a[i]) != FoldCase(b[i])) return false;
+	return true;
+}
@@ -0,0 +1,49 @@
+#ifndef CBA_LEXER_H
+#define CBA_LEXER_H
+#pragma once
+#include "stdafx.h"
+#include <string_view>
+
+// For printing a std::string_view with "%.*s"
+#define VIEW_ARG(v) (int)(v).size(), (v).data()
+
+/*
+	A token is a view into the source buffer, so the buffer must outlive
+	any tokens lexed from it. Case is left untouched; keyword comparisons
+	fold case as they go instead.
+*/
+struct lex_token {
+	std::string_view text;
+	uint offset;
+};
+
+struct lex_line {
+	uint number;
+	uint first;
+	uint count;
+};
+
+// A whole file lexed up front. Lines without tokens are left out.
+struct lexed_file {
+	std::string source;
+	uint line_count;
+	std::vector<lex_token> tokens;
+	std::vector<lex_line> lines;
+};
+
+struct lexer {
+	const char* begin;
+	const char* cursor;
+	const char* end;
+	uint line_number;
+};
+
+bool LEX_ReadFile(std::string path, std::string& buffer);
+
+void LEX_Begin(lexer& lex, const std::string& buffer);
+bool LEX_NextLine(lexer& lex, std::vector<lex_token>& tokens);
+void LEX_Tokenize(lexed_file& file);
+
+bool NoCaseEquals(std::string_view a, std::string_view b);
+
+#endif
@@ -0,0 +1,179 @@
+#include "link.h"
+#include "assembler.h"
+#include "error.h"
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+
+static void WriteU32(std::string& out, uint value) {
+	for (uint i = 0; i < 4; i++) out += (char)((value >> (i * 8)) & 0xFF);
+}
+
+static bool ReadU32(const std::string& in, size_t& pos, uint* value) {
+	if (pos + 4 > in.size()) return false;
+	*value = 0;
+	for (uint i = 0; i < 4; i++) *value |= (uint)(byte)in[pos++] << (i * 8);
+	return true;
+}
+
+static bool ReadBytes(const std::string& in, size_t& pos, uint count, std::string& out) {
+	if (pos + count > in.size()) return false;
+	out.assign(in, pos, count);
+	pos += count;
+	return true;
+}
+
+bool LINK_MakeObject(asm_context& ctx, object_file& object) {
+	if (ctx.byte_overflow != 0) {
+		PushError(ctx, "Module size limit reached: %i/%i bytes", MAX_ROMSIZE + ctx.byte_overflow, MAX_ROMSIZE);
+		return false;
+	}
+	//Labels first, in definition order, then whatever the fixups import
+	std::map<const symbol*, uint> indices;
+	std::vector<const symbol*> symbols;
+	for (const symbol* sym : ctx.symbols.records) {
+		if (sym->kind != SYMBOL_LABEL || SYM_Generated(sym)) continue;
+		indices[sym] = symbols.size();
+		symbols.push_back(sym);
+	}
+	for (const fixup& fix : ctx.fixups) {
+		if (indices.count(fix.target)) continue;
+		indices[fix.target] = symbols.size();
+		symbols.push_back(fix.target);
+	}
+
+	object.path = ctx.base_dir + ctx.output_name;
+	object.code.assign(ctx.rom_output, ctx.rom_index);
+	object.symbols.clear();
+	for (const symbol* sym : symbols) {
+		bool defined = sym->kind == SYMBOL_LABEL;
+		object.symbols.push_back({ std::string(sym->name), defined, defined && SYM_Generated(sym),
+								   defined ? sym->value - CHIP8_MEMSTART : 0 });
+	}
+	object.relocations.clear();
+	for (const fixup& fix : ctx.fixups) object.relocations.push_back({ fix.offset, fix.kind, indices[fix.target] });
+	object.base = 0;
+	return true;
+}
+
+void LINK_WriteObject(asm_context& ctx) {
+	object_file object;
+	if (!LINK_MakeObject(ctx, object) || ctx.options.in_memory) return;
+
+	std::string out = OBJECT_MAGIC;
+	WriteU32(out, object.code.size());
+	WriteU32(out, object.symbols.size());
+	WriteU32(out, object.relocations.size());
+	out += object.code;
+	for (const object_symbol& sym : object.symbols) {
+		WriteU32(out, !sym.defined ? 0 : sym.local ? OBJECT_LOCAL : 1);
+		WriteU32(out, sym.offset);
+		WriteU32(out, sym.name.size());
+		out += sym.name;
+	}
+	for (const object_relocation& reloc : object.relocations) {
+		WriteU32(out, reloc.offset);
+		WriteU32(out, reloc.kind);
+		WriteU32(out, reloc.symbol);
+	}
+
+	bool written;
+	ctx.output_messages = ctx.message_list.size();
+	if (!ASM_WriteOutput(ctx, object.path, out.data(), out.size(), &written)) {
+		PushError(ctx, "Could not create/open object file: \"%s\"", object.path.c_str());
+		return;
+	}
+	if (written) PushMessage(ctx, "Wrote %i bytes, %i symbols and %i relocations to %s.\n",
+							 ctx.rom_index, (uint)object.symbols.size(), (uint)object.relocations.size(), object.path.c_str());
+	else PushMessage(ctx, "%s is unchanged, left as it was.\n", object.path.c_str());
+}
+
+bool LINK_ReadObject(std::string path, object_file& object) {
+	std::ifstream file(path, std::ifstream::binary);
+	if (!file.is_open()) return false;
+	std::string in((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	size_t pos = 0;
+	std::string magic;
+	uint code_size, symbol_count, relocation_count;
+	if (!ReadBytes(in, pos, 4, magic) || magic != OBJECT_MAGIC ||
+		!ReadU32(in, pos, &code_size) || !ReadU32(in, pos, &symbol_count) ||
+		!ReadU32(in, pos, &relocation_count) || !ReadBytes(in, pos, code_size, object.code)) return false;
+
+	object.path = path;
+	object.symbols.resize(symbol_count);
+	for (object_symbol& sym : object.symbols) {
+		uint defined, length;
+		if (!ReadU32(in, pos, &defined) || !ReadU32(in, pos, &sym.offset) ||
+			!ReadU32(in, pos, &length) || !ReadBytes(in, pos, length, sym.name)) return false;
+		sym.defined = defined != 0;
+		sym.local = defined == OBJECT_LOCAL;
+	}
+	object.relocations.resize(relocation_count);
+	for (object_relocation& reloc : object.relocations) {
+		if (!ReadU32(in, pos, &reloc.offset) || !ReadU32(in, pos, &reloc.kind) ||
+			!ReadU32(in, pos, &reloc.symbol)) return false;
+		if (reloc.symbol >= symbol_count || reloc.offset + INSTRUCTION_SIZE > code_size) return false;
+	}
+	return pos == in.size();
+}
+
+void LINK_LinkObjects(asm_context& ctx, std::vector<object_file>& objects) {
+	uint size = 0;
+	for (object_file& object : objects) {
+		object.base = size;
+		size += object.code.size();
+	}
+
+	//Labels share one namespace across modules, just as they do across .includes
+	for (const object_file& object : objects) {
+		for (const object_symbol& sym : object.symbols) {
+			if (!sym.defined || sym.local) continue;
+			symbol* label = SYM_Intern(ctx.symbols, sym.name);
+			if (label->kind == SYMBOL_LABEL) {
+				PushError(ctx, "Label \"%s\" in %s is already defined by an earlier object.",
+						  sym.name.c_str(), object.path.c_str());
+				continue;
+			}
+			label->kind = SYMBOL_LABEL;
+			label->value = CHIP8_MEMSTART + object.base + sym.offset;
+		}
+	}
+
+	for (const object_file& object : objects) {
+		uint fits = (object.base < MAX_ROMSIZE) ? std::min<uint>(object.code.size(), MAX_ROMSIZE - object.base) : 0;
+		std::copy_n(object.code.data(), fits, ctx.rom_output + object.base);
+		for (const object_relocation& reloc : object.relocations) {
+			const object_symbol& sym = object.symbols[reloc.symbol];
+			uint address = CHIP8_MEMSTART + object.base + sym.offset;
+			if (!sym.local) {
+				symbol* label = SYM_Find(ctx.symbols, sym.name);
+				if (!label || label->kind != SYMBOL_LABEL) {
+					PushError(ctx, "Undefined label \"%s\" (referenced from %s).", sym.name.c_str(), object.path.c_str());
+					continue;
+				}
+				address = label->value;
+			}
+			if (object.base + reloc.offset + INSTRUCTION_SIZE <= MAX_ROMSIZE)
+				ASM_PatchField(ctx, object.base + reloc.offset, reloc.kind, address);
+		}
+	}
+	ctx.rom_index = std::min<uint>(size, MAX_ROMSIZE);
+	ctx.byte_overflow = size - ctx.rom_index;
+}
+
+void LINK_Link(asm_context& ctx, const std::vector<std::string>& paths, std::string output_path) {
+	PushMessage(ctx, "Linking \"%s\"...\n", output_path.c_str());
+	std::vector<object_file> objects(paths.size());
+	for (uint i = 0; i < paths.size(); i++) {
+		if (!LINK_ReadObject(paths[i], objects[i]))
+			PushError(ctx, "\"%s\" could not be opened or is not a CBA object file.", paths[i].c_str());
+	}
+	if (!ctx.error_list.empty()) return;
+
+	LINK_LinkObjects(ctx, objects);
+	if (!ctx.error_list.empty()) return;
+	ctx.output_name = output_path;
+	ASM_WriteToFile(ctx);
+	if (ctx.options.depfile && ctx.error_list.empty()) ASM_WriteDepfile(ctx, paths);
+}
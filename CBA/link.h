@@ -0,0 +1,58 @@
+#ifndef CBA_LINK_H
+#define CBA_LINK_H
+#pragma once
+#include "stdafx.h"
+#include "context.h"
+
+/*
+	Relocatable object (.o8) layout, all integers little-endian uint32:
+		"CBO1"
+		code size, symbol count, relocation count
+		code bytes, assembled as if the module started at CHIP8_MEMSTART
+		per symbol:     defined (0, 1, or OBJECT_LOCAL), offset into code, name length, name
+		per relocation: offset into code, FIXUP_ kind, symbol index
+	Every label a module defines is exported, except the ones the assembler
+	makes up (SYM_Generated), which only the module's own relocations see.
+	Every label operand, defined in the module or not, leaves a relocation
+	against its symbol.
+*/
+#define OBJECT_MAGIC "CBO1"
+#define OBJECT_LOCAL 2
+
+struct object_symbol {
+	std::string name;
+	bool defined;
+	bool local;		/* Defined, but not exported */
+	uint offset;
+};
+
+struct object_relocation {
+	uint offset;
+	uint kind;
+	uint symbol;
+};
+
+struct object_file {
+	std::string path;
+	std::string code;
+	std::vector<object_symbol> symbols;
+	std::vector<object_relocation> relocations;
+	uint base;
+};
+
+// Gathers ctx's code, labels and fixups into an object named base_dir +
+// output_name. Returns false, with an error in ctx, if it is too big.
+bool LINK_MakeObject(asm_context& ctx, object_file& object);
+
+// Writes LINK_MakeObject's object to its path, unless options.in_memory is set
+void LINK_WriteObject(asm_context& ctx);
+bool LINK_ReadObject(std::string path, object_file& object);
+
+// Lays the objects out in order from CHIP8_MEMSTART and resolves their
+// relocations into ctx.rom_output, setting each object's base. Errors go to ctx.
+void LINK_LinkObjects(asm_context& ctx, std::vector<object_file>& objects);
+
+// Reads the objects at paths, links them and writes the ROM to output_path
+void LINK_Link(asm_context& ctx, const std::vector<std::string>& paths, std::string output_path);
+
+#endif
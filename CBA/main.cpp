@@ -1,6 +1,17 @@
 #include <stdio.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 #include "assembler.h"
 #include "error.h"
+#include "batch.h"
+#include "workpool.h"
+#include "bench.h"
+#include "watch.h"
+#include "link.h"
+#include "scenario.h"
+#include "budget.h"
 
 //@TODO: More helpful comments, before I forget any of this...
 
@@ -21,27 +32,215 @@
 // so instead the assembler will probably just throw an error.
 
 
+static void PrintUsage() {
+	printf("Use source file as first argument to assemble.\n");
+	printf("e.g: \"cba (game.txt/game.cba)\"\n\n");
+	printf("Batch mode assembles several ROMs in parallel:\n");
+	printf("  cba [-j threads] game1.cba game2.cba ...\n");
+	printf("  cba [-j threads] --manifest roms.txt\n\n");
+	printf("Separate compilation:\n");
+	printf("  cba -c module1.cba module2.cba ...  Assemble each source to a .o8 object\n");
+	printf("  cba --link game.c8 module1.o8 ...   Link objects, in order, into a ROM\n\n");
+	printf("Options:\n");
+	printf("  --stats             Print timings and counters for each ROM\n");
+	printf("  --stats-json <file> Write the same statistics to a JSON file\n");
+	printf("  --watch             Reassemble whenever the source or its includes change\n");
+	printf("  --cache <dir>       Reuse earlier builds of unchanged sources from dir\n");
+	printf("  --cache-size <MB>   Size cap for the cache directory (default %i)\n", BUILD_CACHE_DEFAULT_MB);
+	printf("  --if-changed        Don't rewrite outputs whose bytes haven't changed\n");
+	printf("  --depfile           Write a make-style .d file listing every included file\n");
+	printf("  -I <dir>            Also search dir for .include files\n");
+	printf("  -O                  Run the peephole optimizer over the assembled code\n");
+	printf("  -Os                 Also move repeated instruction sequences into subroutines\n");
+	printf("  --cfg               Write the ROM's basic-block graph to a Graphviz .dot file\n");
+	printf("  --budget            Report each label's best and worst case cycles\n");
+	printf("  --cost-model <cfg>  Cycle costs for --budget and .budget (key=value,...)\n\n");
+	printf("Pipe mode reads the source from stdin and writes the raw ROM to stdout:\n");
+	printf("  generate_level | cba [-I dir] - > level.c8\n\n");
+	printf("ROM regression tests run scenario files on a built-in Chip-8:\n");
+	printf("  cba --run [-j threads] tests1.txt tests2.txt ...\n");
+	printf("  cba --profile [-j threads] tests.txt  Also report where the cycles went, per label\n\n");
+	printf("Benchmarks on a generated program (config is key=value,...):\n");
+	printf("  cba --bench [lines=20000,label_every=16,forward_percent=30,alias_depth=3,\n");
+	printf("               includes=4,data_bytes=1024,seed=1,iterations=10,prefix=bench]\n");
+	printf("  cba --generate [config]  Only write the program\n");
+}
+
+// Reads the source from stdin and writes the raw ROM to stdout. Errors go to
+// stderr, so nothing but ROM bytes ever reaches stdout.
+static int AssemblePipe(const asm_options& options) {
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	std::string source;
+	char buffer[4096];
+	size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), stdin)) > 0) source.append(buffer, count);
+
+	asm_context ctx;
+	ctx.options = options;
+	byte rom[MAX_ROMSIZE];
+	uint size;
+	bool assembled = ASM_AssembleBuffer(ctx, source, "<stdin>", rom, MAX_ROMSIZE, &size);
+	if (!options.stats_json.empty()) STATS_WriteJson(options.stats_json, { &ctx });
+	if (!assembled) {
+		PrintAllErrors(ctx, stderr);
+		return 1;
+	}
+	fwrite(rom, 1, size, stdout);
+	fflush(stdout);
+	return 0;
+}
+
 // Returns 0 if assembly was successful, 1 if there was an error
 // (For making build tools...?)
 int main(int argc, char** args) {
-	printf("Chip-8 Basic Assembler (CBA) Version %s\n\n", CBA_VERSION);
+	bool pipe = false;
+	for (int i = 1; i < argc; i++) pipe = pipe || std::string(args[i]) == "-";
+	if (!pipe) printf("Chip-8 Basic Assembler (CBA) Version %s\n\n", CBA_VERSION);
 
-	argc = 2;
-	args[1] = "main.cba";
+	std::vector<std::string> paths;
+	uint thread_count = DefaultThreadCount();
+	asm_options options;
+	std::string link_output;
+	bool batch = false;
+	bool run = false;
+	bool profile = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = args[i];
+		if (arg == "-j" && i + 1 < argc) {
+			thread_count = std::atoi(args[++i]);
+			batch = true;
+		}
+		else if (arg == "--manifest" && i + 1 < argc) {
+			if (!BATCH_ReadManifest(args[++i], paths)) return 1;
+			batch = true;
+		}
+		else if (arg == "--bench" || arg == "--generate") {
+			bench_config config;
+			if (i + 1 < argc && args[i + 1][0] != '-' && !BENCH_ParseConfig(args[++i], config)) return 1;
+			if (arg == "--bench") return BENCH_Run(config);
+			std::string path = BENCH_Generate(config);
+			if (path.empty()) return 1;
+			printf("Wrote benchmark program \"%s\".\n", path.c_str());
+			return 0;
+		}
+		else if (arg == "--run") {
+			run = true;
+		}
+		else if (arg == "--profile") {
+			run = profile = true;
+		}
+		else if (arg == "-c") {
+			options.relocatable = true;
+		}
+		else if (arg == "--link" && i + 1 < argc) {
+			link_output = args[++i];
+		}
+		else if (arg == "--cache" && i + 1 < argc) {
+			options.cache_dir = args[++i];
+		}
+		else if (arg == "--cache-size" && i + 1 < argc) {
+			options.cache_megabytes = std::atoi(args[++i]);
+		}
+		else if (arg == "--if-changed") {
+			options.write_if_changed = true;
+		}
+		else if (arg == "--depfile") {
+			options.depfile = true;
+		}
+		else if (arg == "-O") {
+			options.optimize = true;
+		}
+		else if (arg == "-Os") {
+			options.optimize = true;
+			options.outline = true;
+		}
+		else if (arg == "--cfg") {
+			options.dump_cfg = true;
+		}
+		else if (arg == "--budget") {
+			options.budget = true;
+		}
+		else if (arg == "--cost-model" && i + 1 < argc) {
+			options.cost_model = args[++i];
+			cost_model model;
+			if (!BUDGET_ParseModel(options.cost_model, model)) return 1;
+		}
+		else if (arg == "-I" && i + 1 < argc) {
+			options.include_paths.push_back(args[++i]);
+		}
+		else if (arg == "--watch") {
+			options.watch = true;
+		}
+		else if (arg == "--stats") {
+			options.print_stats = true;
+		}
+		else if (arg == "--stats-json" && i + 1 < argc) {
+			options.stats_json = args[++i];
+		}
+		else paths.push_back(arg);
+	}
 
-	if (argc != 2) {
-		printf("Use source file as first argument to assemble.\n");
-		printf("e.g: \"cba (game.txt/game.cba)\"\n");
+	if (paths.empty()) {
+		PrintUsage();
 		return 0;
 	}
-	
-	ASM_Begin(args[1]);
-	if (!error_list.empty()) {
-		PrintAllErrors();
+	if (options.print_stats || !options.stats_json.empty()) {
+		STATS_CountAllocations();
+	}
+	if (run) {
+		return SCENARIO_RunAll(paths, thread_count, profile);
+	}
+	if (pipe) {
+		if (paths.size() > 1) {
+			fprintf(stderr, "Pipe mode (-) takes no other source files.\n");
+			return 1;
+		}
+		//stdout only carries the ROM, and there is no file beside the source to write
+		if (options.budget || options.dump_cfg) {
+			fprintf(stderr, "--budget/--cfg can't be used with pipe mode (-).\n");
+			return 1;
+		}
+		return AssemblePipe(options);
+	}
+	if (!link_output.empty()) {
+		asm_context ctx;
+		ctx.options = options;
+		LINK_Link(ctx, paths, link_output);
+		BATCH_PrintResult(ctx);
+		return ctx.error_list.empty() ? 0 : 1;
+	}
+	if (options.watch) {
+		if (batch || paths.size() > 1) {
+			printf("--watch takes a single source file.\n");
+			return 1;
+		}
+		if (options.optimize) {
+			printf("-O/-Os can't be used with --watch.\n");
+			return 1;
+		}
+		if (options.relocatable) {
+			printf("-c can't be used with --watch.\n");
+			return 1;
+		}
+		return WATCH_Run(paths[0], options);
+	}
+	if (batch || paths.size() > 1) {
+		return BATCH_Assemble(paths, thread_count, options);
+	}
+
+	asm_context ctx;
+	ctx.options = options;
+	ASM_Begin(ctx, paths[0]);
+	BATCH_PrintResult(ctx);
+	if (!options.stats_json.empty()) STATS_WriteJson(options.stats_json, { &ctx });
+	if (!ctx.error_list.empty()) {
 		getchar();
 		return 1;
 	}
 
 	getchar();
 	return 0;
-}
\ No newline at end of file
+}
@@ -2,278 +2,282 @@
 #include "assembler.h"
 #include "enforce.h"
 
-#define X(a, x, y) {#a, {op_##a, x, y}},
-std::map<std::string, opcode> opcode_list = { CORE_OPCODES };
+#define X(a, x, y) {op_##a, x, y},
+const opcode opcode_list[OPCODE_COUNT] = { CORE_OPCODES };
 #undef X
 
-Opcode(cls) {
+#define OPERAND_VX  0x00	/* Any of V0 - VF */
+#define OPERAND_V0  0x01
+#define OPERAND_I   0x02
+#define OPERAND_DT  0x03
+#define OPERAND_ST  0x04
+#define OPERAND_N   0x05	/* Exactly a 4-bit literal */
+#define OPERAND_NN  0x06	/* Up to an 8-bit literal */
+#define OPERAND_NNN 0x07	/* Up to a 12-bit literal */
+
+#define FIELD_NONE 0x00
+#define FIELD_X    0x01	/* -x-- */
+#define FIELD_Y    0x02	/* --y- */
+#define FIELD_XY   0x03	/* -xx- */
+#define FIELD_N    0x04	/* ---n */
+#define FIELD_NN   0x05	/* --nn */
+#define FIELD_NNN  0x06	/* -nnn */
+
+struct operand_pattern {
+	uint kind;
+	uint field;
+};
+
+/*
+	One legal form of an instruction: the operands it takes, and where each
+	operand's value is placed in the base word to produce the encoding.
+*/
+struct encoding {
+	uint op;
+	word base;
+	uint count;
+	operand_pattern operands[3];
+};
+
+#define VX(f)	{ OPERAND_VX,  FIELD_##f }
+#define NN		{ OPERAND_NN,  FIELD_NN }
+#define NNN		{ OPERAND_NNN, FIELD_NNN }
+#define REG(r)	{ OPERAND_##r, FIELD_NONE }
+
+static const encoding encoding_table[] = {
 	/* Clear the display buffer */
-	Word_Output(0x00E0);
-}
-Opcode(ret) {
+	{ OP_cls,  0x00E0, 0 },
 	/* Set the program counter to the address at the top of the stack, then subtract 1 from the stack pointer. */
-	Word_Output(0x00EE);
-}
-Opcode(jp) {
-	if (!EnforceType(args[0], TYPE_LITERAL)) return;
-	if (args.size() == 2) {
-		if (!EnforceType(args[1], TYPE_REGISTER) ||	
-			!EnforceRegister(args[1], V0)) return;
-		/* Set the program counter to <address> plus the value of V0 */
-		Word_Output(0xB000 | args[0].value);
-	}
-	else {
-		/* Set the program counter to <address> */
-		Word_Output(0x1000 | args[0].value);
-	}
-}
-Opcode(call) {
+	{ OP_ret,  0x00EE, 0 },
+	/* Set the program counter to <address> */
+	{ OP_jp,   0x1000, 1, { NNN } },
+	/* Set the program counter to <address> plus the value of V0 */
+	{ OP_jp,   0xB000, 2, { NNN, REG(V0) } },
 	/* Put the current program counter address on the top of the stack and increment the stack pointer.
 	The program counter is then set the subroutine at <address> */
-	if (!EnforceType(args[0], TYPE_LITERAL)) return;
-	Word_Output(0x2000 | args[0].value);
-}
-Opcode(se) {
-	if (!EnforceType(args[0], TYPE_REGISTER) || 
-		!EnforceRegisterV(args[0])) return;
-	byte x = args[0].value;
-	if (args[1].type == TYPE_LITERAL) {
-		/* Skip next instruction if Vx == <byte literal> */
-		if (!EnforceBitcount(args[1], LITERAL_8)) return;
-		Word_Output(0x30 | x, args[1].value);
-	}
-	else if (args[1].type == TYPE_REGISTER) {
-		if (!EnforceRegisterV(args[1])) return;
-		byte y = args[1].value;
-		Word_Output(0x50 | x, y << 4);
-	}
-	else PushError("Expected V[0-F] or 8-bit literal as second arg.");
-}
-Opcode(sne) {
-	if (!EnforceType(args[0], TYPE_REGISTER) ||	
-		!EnforceRegisterV(args[0])) return;
-	byte x = args[0].value;
-	if (args[1].type == TYPE_LITERAL) {
-		/* Skip next instruction if Vx != <byte literal> */
-		if (!EnforceBitcount(args[1], LITERAL_8)) return;
-		Word_Output(0x40 | x, args[1].value);
-	}
-	else if (args[1].type == TYPE_REGISTER) {
-		/* Skip next instruction if Vx != Vy */
-		if (!EnforceRegisterV(args[1])) return;
-		byte y = args[1].value;
-		Word_Output(0x90 | x, y << 4);
-	}
-	else PushError("Expected V[0-F] or 8-bit literal as second arg.");
-}
-Opcode(ld) {
-	if (!EnforceType(args[0], TYPE_REGISTER)) return;
-	if (args[0].value <= VF) {
-		uint x = args[0].value;
-		if (args[1].type == TYPE_REGISTER) {
-			if (args[1].value <= VF) {
-				/* Load the value of Vy into Vx */
-				byte y = args[1].value;
-				Word_Output(0x80 | x, y << 4);
-			}
-			else if (args[1].value == DT) {
-				/* Load the value of DT into Vx */
-				Word_Output(0xF0 | x, 0x07);
-			}
-			else if (args[1].value == I) {
-				/* Load into registers V0 to Vx values starting from memory address I*/
-				Word_Output(0xF0 | x, 0x65);
-			}
-			else PushError("ST is write-only.");
-		}
-		else if (args[1].type == TYPE_LITERAL) {
-			/* Load the value <byte literal> into Vx */
-			if (!EnforceBitcount(args[1], LITERAL_8)) return;
-			Word_Output(0x60 | x, args[1].value);
-		}
-		else PushError("Expected V[0-F] or 8-bit literal as second arg.");
-	}
-	else if (args[0].value == I) {
-		if (args[1].type == TYPE_LITERAL) {
-			/* Load <address> into I */
-			if (!EnforceBitcount(args[1], LITERAL_12)) return;
-			Word_Output(0xA000 | args[1].value);
-		}
-		else if (args[1].type == TYPE_REGISTER) {
-			/* Write to memory address I with values from registers V0 to Vx */
-			if (!EnforceRegisterV(args[1])) return;
-			Word_Output(0xF0 | args[1].value, 0x55);
-		}
-		else PushError("Expected V[0-F] or 12-bit literal as second arg.");
-	}
-	else if (args[0].value == DT) {
-		/* Load value of Vx into DT */
-		if (!EnforceType(args[1], TYPE_REGISTER) ||	
-			!EnforceRegisterV(args[1])) return;
-		Word_Output(0xF0 | args[1].value, 0x15);
-	}
-	else if (args[0].value == ST) {
-		if (!EnforceType(args[1], TYPE_REGISTER) ||	
-			!EnforceRegisterV(args[1])) return;
-		Word_Output(0xF0 | args[1].value, 0x18);
-	}
-}
-Opcode(or) {
+	{ OP_call, 0x2000, 1, { NNN } },
+	/* Skip next instruction if Vx == <byte literal> */
+	{ OP_se,   0x3000, 2, { VX(X), NN } },
+	/* Skip next instruction if Vx == Vy */
+	{ OP_se,   0x5000, 2, { VX(X), VX(Y) } },
+	/* Skip next instruction if Vx != <byte literal> */
+	{ OP_sne,  0x4000, 2, { VX(X), NN } },
+	/* Skip next instruction if Vx != Vy */
+	{ OP_sne,  0x9000, 2, { VX(X), VX(Y) } },
+	/* Load the value <byte literal> into Vx */
+	{ OP_ld,   0x6000, 2, { VX(X), NN } },
+	/* Load the value of Vy into Vx */
+	{ OP_ld,   0x8000, 2, { VX(X), VX(Y) } },
+	/* Load the value of DT into Vx */
+	{ OP_ld,   0xF007, 2, { VX(X), REG(DT) } },
+	/* Load into registers V0 to Vx values starting from memory address I */
+	{ OP_ld,   0xF065, 2, { VX(X), REG(I) } },
+	/* Load <address> into I */
+	{ OP_ld,   0xA000, 2, { REG(I), NNN } },
+	/* Write to memory address I with values from registers V0 to Vx */
+	{ OP_ld,   0xF055, 2, { REG(I), VX(X) } },
+	/* Load value of Vx into DT */
+	{ OP_ld,   0xF015, 2, { REG(DT), VX(X) } },
+	/* Load value of Vx into ST */
+	{ OP_ld,   0xF018, 2, { REG(ST), VX(X) } },
 	/* Performs bitwise OR on Vx and Vy, stores the result in Vx */
-	if (!EnforceType(args[0], TYPE_REGISTER) || !EnforceRegisterV(args[0]) ||
-		!EnforceType(args[1], TYPE_REGISTER) || !EnforceRegisterV(args[1])) return;
-	Word_Output(0x80 | args[0].value, (args[1].value << 4) | 0x01);
-}
-Opcode(and) {
+	{ OP_or,   0x8001, 2, { VX(X), VX(Y) } },
 	/* Performs bitwise AND on Vx and Vy, stores the result in Vx */
-	if (!EnforceType(args[0], TYPE_REGISTER) || !EnforceRegisterV(args[0]) ||
-		!EnforceType(args[1], TYPE_REGISTER) || !EnforceRegisterV(args[1])) return;
-	Word_Output(0x80 | args[0].value, (args[1].value << 4) | 0x02);
-}
-Opcode(xor) {
+	{ OP_and,  0x8002, 2, { VX(X), VX(Y) } },
 	/* Performs bitwise XOR on Vx and Vy, stores the result in Vx */
-	if (!EnforceType(args[0], TYPE_REGISTER) || !EnforceRegisterV(args[0]) ||
-		!EnforceType(args[1], TYPE_REGISTER) || !EnforceRegisterV(args[1])) return;
-	Word_Output(0x80 | args[0].value, (args[1].value << 4) | 0x03);
-}
-Opcode(add) {
-	if (!EnforceType(args[0], TYPE_REGISTER)) return;
-	if (args[0].value <= VF) {
-		if (args[1].type == TYPE_LITERAL) {
-			/* Set Vx to the value of Vx + <byte literal> */
-			if (!EnforceBitcount(args[1], LITERAL_8)) return;
-			Word_Output(0x70 | args[0].value, args[1].value);
-		}
-		else if (args[1].type == TYPE_REGISTER) {
-			/* Set Vx to the value of Vx + Vy. Set VF to 1 if there is a carry, 0 if there is not */
-			if (!EnforceRegisterV(args[1])) return;
-			Word_Output(0x80 | args[0].value, (args[1].value << 4) | 0x04);
-		}
-		else PushError("Expected V[0-F] or 8-bit literal as second arg.");
-	}
-	else if (args[0].value == I) {
-		/* Set I to memory address I + Vx */
-		if (!EnforceRegisterV(args[1])) return;
-		Word_Output(0xF | args[1].value, 0x1E);
-	}
-	else PushError("Expected V[0-F] or I as first arg.");
-}
-Opcode(sub) {
+	{ OP_xor,  0x8003, 2, { VX(X), VX(Y) } },
+	/* Set Vx to the value of Vx + <byte literal> */
+	{ OP_add,  0x7000, 2, { VX(X), NN } },
+	/* Set Vx to the value of Vx + Vy. Set VF to 1 if there is a carry, 0 if there is not */
+	{ OP_add,  0x8004, 2, { VX(X), VX(Y) } },
+	/* Set I to memory address I + Vx */
+	{ OP_add,  0xF01E, 2, { REG(I), VX(X) } },
 	/* Set Vx to the value of Vx - Vy. Set VF to 0 if there is a borrow, 1 if there is not */
-	if (!EnforceType(args[0], TYPE_REGISTER) || !EnforceRegisterV(args[0]) ||
-		!EnforceType(args[1], TYPE_REGISTER) || !EnforceRegisterV(args[1])) return;
-	Word_Output(0x80 | args[0].value, (args[1].value << 4) | 0x05);
-}
-Opcode(shr) {
-	if (!EnforceType(args[0], TYPE_REGISTER) ||	
-		!EnforceRegisterV(args[0])) return;
-	if (args.size() == 2) {
-		if (!EnforceType(args[1], TYPE_REGISTER) ||	
-			!EnforceRegisterV(args[1])) return;
-		/* Store Vy bitshifted right into Vx. Set VF to lsb of Vy */
-		Word_Output(0x80 | args[0].value, (args[1].value << 4) | 0x06);
-	}
-	else {
-		/* Bitshift Vx to the right. Set VF to lsb of Vx before shift */
-		Word_Output(0x80 | args[0].value, (args[0].value << 4) | 0x06);
-	}
-}
-Opcode(shl) {
-	if (!EnforceType(args[0], TYPE_REGISTER) ||	
-		!EnforceRegisterV(args[0])) return;
-	if (args.size() == 2) {
-		if (!EnforceType(args[1], TYPE_REGISTER) ||	
-			!EnforceRegisterV(args[1])) return;
-		/* Store Vy bitshifted left into Vx. Set VF to lsb of Vy */
-		Word_Output(0x80 | args[0].value, (args[1].value << 4) | 0x0E);
-	}
-	else {
-		/* Bitshift Vx to the left. Set VF to msb of Vx before shift */
-		Word_Output(0x80 | args[0].value, (args[0].value << 4) | 0x0E);
-	}
-}
-Opcode(subn) {
+	{ OP_sub,  0x8005, 2, { VX(X), VX(Y) } },
+	/* Store Vy bitshifted right into Vx. Set VF to lsb of Vy */
+	{ OP_shr,  0x8006, 2, { VX(X), VX(Y) } },
+	/* Bitshift Vx to the right. Set VF to lsb of Vx before shift */
+	{ OP_shr,  0x8006, 1, { VX(XY) } },
 	/* Set Vx to the value of Vy - Vx. Set VF to 0 if there is a borrow, 1 if there is not */
-	if (!EnforceType(args[0], TYPE_REGISTER) || !EnforceRegisterV(args[0]) ||
-		!EnforceType(args[1], TYPE_REGISTER) || !EnforceRegisterV(args[1])) return;
-	Word_Output(0x80 | args[0].value, (args[1].value << 4) | 0x07);
-}
-Opcode(rand) {
-	if (!EnforceType(args[0], TYPE_REGISTER) ||	
-		!EnforceRegisterV(args[0])) return;
-	if (args.size() == 2) {
-		/* Set Vx to a random value with the range of 0 to <byte literal> */
-		if (!EnforceType(args[1], TYPE_LITERAL) || 
-			!EnforceBitcount(args[1], LITERAL_8)) return;
-		Word_Output(0xC0 | args[0].value, args[1].value);
-	}
-	else {
-		/* Set Vx to a random value with the range of 0 to 255 */
-		Word_Output(0xC0 | args[0].value, 0xFF);
-	}
-}
-Opcode(draw) {
+	{ OP_subn, 0x8007, 2, { VX(X), VX(Y) } },
+	/* Store Vy bitshifted left into Vx. Set VF to lsb of Vy */
+	{ OP_shl,  0x800E, 2, { VX(X), VX(Y) } },
+	/* Bitshift Vx to the left. Set VF to msb of Vx before shift */
+	{ OP_shl,  0x800E, 1, { VX(XY) } },
+	/* Set Vx to a random value with the range of 0 to <byte literal> */
+	{ OP_rand, 0xC000, 2, { VX(X), NN } },
+	/* Set Vx to a random value with the range of 0 to 255 */
+	{ OP_rand, 0xC0FF, 1, { VX(X) } },
 	/*
 	Display n-byte sprite starting at the memory address in I. Draw the sprite at coordinates (Vx, Vy).
 	If the sprite is drawn over any existing pixels, set VF to 1, otherwise 0.
 	*/
-	if (!EnforceType(args[0], TYPE_REGISTER) || !EnforceRegisterV(args[0]) ||
-		!EnforceType(args[1], TYPE_REGISTER) || !EnforceRegisterV(args[1]) ||
-		!EnforceType(args[2], TYPE_LITERAL)  || !EnforceBitcountEx(args[2], LITERAL_4)) return;
-	Word_Output(0xD0 | args[0].value, (args[1].value) << 4 | args[2].value);
-}
-Opcode(skp) {
+	{ OP_draw, 0xD000, 3, { VX(X), VX(Y), { OPERAND_N, FIELD_N } } },
 	/* Skip next instruction if the key in Vx is pressed */
-	if (!EnforceType(args[0], TYPE_REGISTER) || 
-		!EnforceRegisterV(args[0])) return;
-	Word_Output(0xE0 | args[0].value, 0x9E);
-}
-Opcode(sknp) {
+	{ OP_skp,  0xE09E, 1, { VX(X) } },
 	/* Skip next instruction if the key in Vx is NOT pressed */
-	if (!EnforceType(args[0], TYPE_REGISTER) || 
-		!EnforceRegisterV(args[0])) return;
-	Word_Output(0xE0 | args[0].value, 0xA1);
-}
-Opcode(wkp) {
+	{ OP_sknp, 0xE0A1, 1, { VX(X) } },
 	/* Halt instruction execution until a key is pressed, then store the key value in Vx */
-	if (!EnforceType(args[0], TYPE_REGISTER) || 
-		!EnforceRegisterV(args[0])) return;
-	Word_Output(0xF0 | args[0].value, 0x0A);
-}
-Opcode(fnt) {
+	{ OP_wkp,  0xF00A, 1, { VX(X) } },
 	/* Set I to the address of font sprite corresponding to hex value of Vx */
-	if (!EnforceType(args[0], TYPE_REGISTER) ||
-		!EnforceRegisterV(args[0])) return;
-	Word_Output(0xF0 | args[0].value, 0x29);
-}
-Opcode(bcd) {
+	{ OP_fnt,  0xF029, 1, { VX(X) } },
 	/* Store binary-coded decimal value of Vx at address I, I+1, and I+2 */
-	if (!EnforceType(args[0], TYPE_REGISTER) ||
-		!EnforceRegisterV(args[0])) return;
-	Word_Output(0xF0 | args[0].value, 0x33);
+	{ OP_bcd,  0xF033, 1, { VX(X) } },
+};
+
+#undef VX
+#undef NN
+#undef NNN
+#undef REG
+
+#define MATCH_NONE    0
+#define MATCH_TYPE    1
+#define MATCH_OPERAND 2
+
+static uint MatchOperand(const operand_pattern& pattern, const token& tkn) {
+	switch (pattern.kind) {
+	case OPERAND_VX:
+		if (tkn.type != TYPE_REGISTER) return MATCH_NONE;
+		return (tkn.value <= VF) ? MATCH_OPERAND : MATCH_TYPE;
+	case OPERAND_V0: case OPERAND_I: case OPERAND_DT: case OPERAND_ST: {
+		static const uint registers[] = { V0, I, DT, ST };
+		if (tkn.type != TYPE_REGISTER) return MATCH_NONE;
+		return (tkn.value == registers[pattern.kind - OPERAND_V0]) ? MATCH_OPERAND : MATCH_TYPE;
+	}
+	case OPERAND_N:
+		if (tkn.type != TYPE_LITERAL) return MATCH_NONE;
+		return (tkn.bitcount == LITERAL_4) ? MATCH_OPERAND : MATCH_TYPE;
+	case OPERAND_NN:
+		if (tkn.type != TYPE_LITERAL) return MATCH_NONE;
+		return (tkn.bitcount <= LITERAL_8) ? MATCH_OPERAND : MATCH_TYPE;
+	case OPERAND_NNN:
+		if (tkn.type != TYPE_LITERAL) return MATCH_NONE;
+		return (tkn.bitcount <= LITERAL_12) ? MATCH_OPERAND : MATCH_TYPE;
+	}
+	return MATCH_NONE;
+}
+
+// Reports why tkn does not fit pattern, using the usual Enforce messages
+static void ReportOperand(asm_context& ctx, const operand_pattern& pattern, const token& tkn) {
+	switch (pattern.kind) {
+	case OPERAND_VX:
+		if (EnforceType(ctx, tkn, TYPE_REGISTER)) EnforceRegisterV(ctx, tkn);
+		break;
+	case OPERAND_V0:
+		if (EnforceType(ctx, tkn, TYPE_REGISTER)) EnforceRegister(ctx, tkn, V0);
+		break;
+	case OPERAND_I:
+		if (EnforceType(ctx, tkn, TYPE_REGISTER)) EnforceRegister(ctx, tkn, I);
+		break;
+	case OPERAND_DT:
+		if (EnforceType(ctx, tkn, TYPE_REGISTER)) EnforceRegister(ctx, tkn, DT);
+		break;
+	case OPERAND_ST:
+		if (EnforceType(ctx, tkn, TYPE_REGISTER)) EnforceRegister(ctx, tkn, ST);
+		break;
+	case OPERAND_N:
+		if (EnforceType(ctx, tkn, TYPE_LITERAL)) EnforceBitcountEx(ctx, tkn, LITERAL_4);
+		break;
+	case OPERAND_NN:
+		if (EnforceType(ctx, tkn, TYPE_LITERAL)) EnforceBitcount(ctx, tkn, LITERAL_8);
+		break;
+	case OPERAND_NNN:
+		if (EnforceType(ctx, tkn, TYPE_LITERAL)) EnforceBitcount(ctx, tkn, LITERAL_12);
+		break;
+	}
+}
+
+static word Encode(const encoding& enc, const operands& args) {
+	word result = enc.base;
+	for (uint i = 0; i < enc.count; i++) {
+		uint value = args[i].value;
+		switch (enc.operands[i].field) {
+		case FIELD_X:   result |= (value & 0xF) << 8; break;
+		case FIELD_Y:   result |= (value & 0xF) << 4; break;
+		case FIELD_XY:  result |= ((value & 0xF) << 8) | ((value & 0xF) << 4); break;
+		case FIELD_N:   result |= value & 0xF; break;
+		case FIELD_NN:  result |= value & 0xFF; break;
+		case FIELD_NNN: result |= value & 0xFFF; break;
+		}
+	}
+	return result;
 }
+
+/*
+	Emits the first encoding of op whose operand pattern fits args. If none
+	fits, the error is reported against the encoding that got furthest, at
+	the first operand it rejected.
+*/
+static void EncodeInstruction(asm_context& ctx, uint op, const operands& args) {
+	const encoding* closest = nullptr;
+	uint closest_score = 0, closest_operand = 0;
+	for (const encoding& enc : encoding_table) {
+		if (enc.op != op || enc.count != args.size()) continue;
+		uint score = 0, i = 0;
+		for (; i < enc.count; i++) {
+			uint match = MatchOperand(enc.operands[i], args[i]);
+			score += match;
+			if (match != MATCH_OPERAND) break;
+		}
+		if (i == enc.count) {
+			Word_Output(ctx, Encode(enc, args));
+			return;
+		}
+		if (closest == nullptr || score > closest_score) {
+			closest = &enc;
+			closest_score = score;
+			closest_operand = i;
+		}
+	}
+	if (closest != nullptr)
+		ReportOperand(ctx, closest->operands[closest_operand], args[closest_operand]);
+}
+
+Opcode(cls)  { EncodeInstruction(ctx, OP_cls,  args); }
+Opcode(ret)  { EncodeInstruction(ctx, OP_ret,  args); }
+Opcode(jp)   { EncodeInstruction(ctx, OP_jp,   args); }
+Opcode(call) { EncodeInstruction(ctx, OP_call, args); }
+Opcode(se)   { EncodeInstruction(ctx, OP_se,   args); }
+Opcode(sne)  { EncodeInstruction(ctx, OP_sne,  args); }
+Opcode(ld)   { EncodeInstruction(ctx, OP_ld,   args); }
+Opcode(or)   { EncodeInstruction(ctx, OP_or,   args); }
+Opcode(and)  { EncodeInstruction(ctx, OP_and,  args); }
+Opcode(xor)  { EncodeInstruction(ctx, OP_xor,  args); }
+Opcode(add)  { EncodeInstruction(ctx, OP_add,  args); }
+Opcode(sub)  { EncodeInstruction(ctx, OP_sub,  args); }
+Opcode(shr)  { EncodeInstruction(ctx, OP_shr,  args); }
+Opcode(subn) { EncodeInstruction(ctx, OP_subn, args); }
+Opcode(shl)  { EncodeInstruction(ctx, OP_shl,  args); }
+Opcode(rand) { EncodeInstruction(ctx, OP_rand, args); }
+Opcode(draw) { EncodeInstruction(ctx, OP_draw, args); }
+Opcode(skp)  { EncodeInstruction(ctx, OP_skp,  args); }
+Opcode(sknp) { EncodeInstruction(ctx, OP_sknp, args); }
+Opcode(wkp)  { EncodeInstruction(ctx, OP_wkp,  args); }
+Opcode(fnt)  { EncodeInstruction(ctx, OP_fnt,  args); }
+Opcode(bcd)  { EncodeInstruction(ctx, OP_bcd,  args); }
+
 Opcode(dw) {
-	if (!EnforceType(args[0], TYPE_LITERAL)) return;
+	if (!EnforceType(ctx, args[0], TYPE_LITERAL)) return;
 	if (args.size() == 2) {
-		if (!EnforceType(args[1], TYPE_LITERAL)  || 
-			!EnforceBitcountEx(args[0], LITERAL_8) ||
-			!EnforceBitcountEx(args[1], LITERAL_8)) return;
-		Word_Output(args[0].value, args[1].value);
+		if (!EnforceType(ctx, args[1], TYPE_LITERAL)  ||
+			!EnforceBitcountEx(ctx, args[0], LITERAL_8) ||
+			!EnforceBitcountEx(ctx, args[1], LITERAL_8)) return;
+		Word_Output(ctx, args[0].value, args[1].value);
 	}
 	else {
-		if (!EnforceBitcount(args[0], LITERAL_16)) return;
-		Word_Output(args[0].value);
+		if (!EnforceBitcount(ctx, args[0], LITERAL_16)) return;
+		Word_Output(ctx, args[0].value);
 	}
 }
 Opcode(db) {
-	if (!EnforceType(args[0], TYPE_LITERAL) || 
-		!EnforceBitcount(args[0], LITERAL_8)) return;
-	Byte_Output(args[0].value);
+	if (!EnforceType(ctx, args[0], TYPE_LITERAL) ||
+		!EnforceBitcount(ctx, args[0], LITERAL_8)) return;
+	Byte_Output(ctx, args[0].value);
 }
 Opcode(dbs) {
-	for (auto arg : args) {
-		if (!EnforceType(args[0], TYPE_LITERAL) ||
-			!EnforceBitcount(args[0], LITERAL_8)) return;
-		Byte_Output(arg.value);
+	for (const token& arg : args) {
+		if (!EnforceType(ctx, arg, TYPE_LITERAL) ||
+			!EnforceBitcount(ctx, arg, LITERAL_8)) return;
+		Byte_Output(ctx, arg.value);
 	}
-}
\ No newline at end of file
+}
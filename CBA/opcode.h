@@ -2,6 +2,7 @@
 #define CBA_OPCODE_H
 #pragma once
 #include "stdafx.h"
+#include "context.h"
 
 /*
 http://devernay.free.fr/hacks/chip8/C8TECH10.HTM
@@ -17,21 +18,39 @@ https://en.wikipedia.org/wiki/CHIP-8
 #define LITERAL_12 12
 #define LITERAL_16 16
 
+#define CORE_REGISTERS \
+	X(V0, v0) X(V1, v1) X(V2, v2) X(V3, v3)\
+	X(V4, v4) X(V5, v5) X(V6, v6) X(V7, v7)\
+	X(V8, v8) X(V9, v9) X(VA, va) X(VB, vb)\
+	X(VC, vc) X(VD, vd) X(VE, ve) X(VF, vf)\
+	X(I, i) X(DT, dt) X(ST, st)
+
+#define X(a, b) a,
 enum RegisterValues {
-	V0, V1, V2, V3,
-	V4, V5, V6, V7,
-	V8, V9, VA, VB,
-	VC, VD, VE, VF,
-	I, DT, ST,
+	CORE_REGISTERS
 	REGISTER_COUNT
 };
+#undef X
+
+#define MAX_OPERANDS 99
 
 struct token {
 	uint value;
 	uint type;
 	uint bitcount;
 };
-typedef void(*op_ptr)(std::vector<token>);
+
+// Fixed-capacity operand list, so encoding an instruction never allocates
+struct operands {
+	token args[MAX_OPERANDS];
+	uint count;
+
+	const token& operator[](uint i) const { return args[i]; }
+	uint size() const { return count; }
+	const token* begin() const { return args; }
+	const token* end() const { return args + count; }
+};
+typedef void(*op_ptr)(asm_context&, const operands&);
 typedef void(*dir_ptr)(std::vector<std::string>);
 
 struct opcode {
@@ -40,7 +59,7 @@ struct opcode {
 	uint   max;
 };
 
-#define Opcode(a) void op_##a(std::vector<token> args)
+#define Opcode(a) void op_##a(asm_context& ctx, const operands& args)
 
 #define CORE_OPCODES \
 	X(cls,  0   )\
@@ -67,12 +86,20 @@ struct opcode {
 	X(bcd,	1	)\
 	X(dw,   1, 2)\
 	X(db,   1   )\
-	X(dbs,  1, 99)
+	X(dbs,  1, MAX_OPERANDS)
 
 #define X(a, x, y) Opcode(a);
 CORE_OPCODES
 #undef X
 
-extern std::map<std::string, opcode> opcode_list;
+#define X(a, x, y) OP_##a,
+enum OpcodeValues {
+	CORE_OPCODES
+	OPCODE_COUNT
+};
+#undef X
+
+// Indexed by OpcodeValues
+extern const opcode opcode_list[OPCODE_COUNT];
 
 #endif
\ No newline at end of file
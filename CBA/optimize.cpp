@@ -0,0 +1,987 @@
+#include "optimize.h"
+#include "error.h"
+#include "cfg.h"
+#include "opcode.h"
+#include "vm.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+struct opt_item {
+	uint offset;
+	uint size;
+	bool code;
+	word op;
+	int fixup;			/* Index into ctx.fixups, or -1 */
+	bool labelled;		/* A label points at this item */
+	bool after_skip;	/* Follows se/sne/skp/sknp, so must stay where it is */
+	bool removed;
+	bool outlined;		/* Part of a subroutine made by OutlineSequences */
+	bool packed;		/* The run PackData made, held in state.packed */
+	uint entries;		/* For a .switch jp v0, the jp entries that follow it */
+	bool in_table;		/* One of those entries, so it can't move or go */
+};
+
+// A run of code or data stripped for being unreachable
+struct stripped_region {
+	std::string name;
+	bool code;
+	uint bytes;
+	uint file;
+	uint line;
+};
+
+struct opt_state {
+	asm_context& ctx;
+	std::vector<opt_item> items;
+	bool movable;		/* Items may be removed, not just rewritten */
+	uint removed;
+	uint rewritten;
+	std::map<uint, std::string_view> labels;	/* Offset -> first label defined there */
+	std::vector<stripped_region> stripped;
+	uint tail;			/* Offset past the last item, where outlined code goes */
+	std::string packed;
+};
+
+typedef bool(*opt_rule)(opt_state&, uint);
+
+struct peephole_rule {
+	const char* name;
+	opt_rule apply;
+};
+
+#define RULE_COUNT (sizeof(rule_table) / sizeof(rule_table[0]))
+
+#define OP_TOP(op) ((op) >> 12)
+#define OP_X(op)   (((op) >> 8) & 0xF)
+#define OP_Y(op)   (((op) >> 4) & 0xF)
+#define OP_NN(op)  ((op) & 0xFF)
+
+static bool IsSkip(word op) {
+	switch (OP_TOP(op)) {
+	case 0x3: case 0x4: case 0x5: case 0x9: return true;
+	case 0xE: return OP_NN(op) == 0x9E || OP_NN(op) == 0xA1;
+	}
+	return false;
+}
+
+// Index of the next item still in the ROM after i, or -1
+static int NextKept(const opt_state& state, uint i) {
+	for (uint j = i + 1; j < state.items.size(); j++) {
+		if (!state.items[j].removed) return j;
+	}
+	return -1;
+}
+
+// Index of the first item still in the ROM at or after offset, or -1
+static int FirstKeptAt(const opt_state& state, uint offset) {
+	auto at = std::lower_bound(state.items.begin(), state.items.end(), offset,
+							   [](const opt_item& item, uint o) { return item.offset < o; });
+	for (; at != state.items.end(); at++) {
+		if (!at->removed) return (int)(at - state.items.begin());
+	}
+	return -1;
+}
+
+// The item a jp/call/ld i lands on, or -1 if its label isn't defined here
+static int TargetItem(const opt_state& state, const opt_item& item) {
+	if (item.fixup < 0) return -1;
+	const symbol* target = state.ctx.fixups[item.fixup].target;
+	if (target->kind != SYMBOL_LABEL) return -1;
+	return FirstKeptAt(state, target->value - CHIP8_MEMSTART);
+}
+
+static bool Remove(opt_state& state, uint i) {
+	opt_item& item = state.items[i];
+	if (!state.movable || item.after_skip || item.in_table) return false;
+	item.removed = true;
+	state.removed++;
+	//Its labels now land on whatever comes next
+	int next = NextKept(state, i);
+	if (item.labelled && next >= 0) state.items[next].labelled = true;
+	return true;
+}
+
+static bool SameTarget(const opt_state& state, const opt_item& a, const opt_item& b) {
+	if (a.fixup < 0 || b.fixup < 0) return a.fixup < 0 && b.fixup < 0 && a.op == b.op;
+	return state.ctx.fixups[a.fixup].target == state.ctx.fixups[b.fixup].target;
+}
+
+/*****************************************/
+/*										 */
+/*				  RULES					 */
+/*                                       */
+/*****************************************/
+// ld vx vx
+static bool RuleLoadSelf(opt_state& state, uint i) {
+	word op = state.items[i].op;
+	if (OP_TOP(op) != 0x8 || (op & 0xF) != 0x0 || OP_X(op) != OP_Y(op)) return false;
+	return Remove(state, i);
+}
+
+// add vx 0
+static bool RuleAddZero(opt_state& state, uint i) {
+	word op = state.items[i].op;
+	if (OP_TOP(op) != 0x7 || OP_NN(op) != 0) return false;
+	return Remove(state, i);
+}
+
+// jp to the instruction after it, once everything in between is gone
+static bool RuleJumpNext(opt_state& state, uint i) {
+	const opt_item& item = state.items[i];
+	if (OP_TOP(item.op) != 0x1 || item.fixup < 0) return false;
+	const symbol* target = state.ctx.fixups[item.fixup].target;
+	if (target->kind != SYMBOL_LABEL) return false;
+	uint address = target->value - CHIP8_MEMSTART;
+	if (address < item.offset + item.size) return false;
+	for (uint j = i + 1; j < state.items.size() && state.items[j].offset < address; j++) {
+		if (!state.items[j].removed) return false;
+	}
+	return Remove(state, i);
+}
+
+// ld i X ... ld i X, with nothing in between that could change I or be
+// jumped to. Skips in between don't matter; they can only skip an
+// instruction that leaves I alone.
+static bool RuleReloadI(opt_state& state, uint i) {
+	const opt_item& first = state.items[i];
+	if (OP_TOP(first.op) != 0xA) return false;
+	for (int j = NextKept(state, i); j >= 0; j = NextKept(state, j)) {
+		const opt_item& item = state.items[j];
+		if (!item.code || item.labelled) return false;
+		word op = item.op;
+		if (OP_TOP(op) == 0xA) return SameTarget(state, first, item) && Remove(state, j);
+		bool flow = OP_TOP(op) == 0x1 || OP_TOP(op) == 0x2 || OP_TOP(op) == 0xB || op == 0x00EE;
+		bool writes_i = OP_TOP(op) == 0xF && (OP_NN(op) == 0x1E || OP_NN(op) == 0x29);
+		if (flow || writes_i) return false;
+	}
+	return false;
+}
+
+// ld vx NN followed by something that overwrites vx without reading it
+static bool RuleDeadLoad(opt_state& state, uint i) {
+	word op = state.items[i].op;
+	if (OP_TOP(op) != 0x6) return false;
+	int j = NextKept(state, i);
+	if (j < 0 || !state.items[j].code) return false;
+	word next = state.items[j].op;
+	if (OP_X(next) != OP_X(op)) return false;
+	bool overwrites = OP_TOP(next) == 0x6 || OP_TOP(next) == 0xC ||
+					  (OP_TOP(next) == 0x8 && (next & 0xF) == 0x0 && OP_Y(next) != OP_X(next)) ||
+					  (OP_TOP(next) == 0xF && OP_NN(next) == 0x07);
+	return overwrites && Remove(state, i);
+}
+
+// add vx A, add vx B -> add vx A+B (7xNN leaves VF alone, so this is exact)
+static bool RuleMergeAdd(opt_state& state, uint i) {
+	opt_item& first = state.items[i];
+	if (OP_TOP(first.op) != 0x7 || first.after_skip) return false;
+	int j = NextKept(state, i);
+	if (j < 0 || !state.items[j].code || state.items[j].labelled) return false;
+	word next = state.items[j].op;
+	if (OP_TOP(next) != 0x7 || OP_X(next) != OP_X(first.op)) return false;
+	if (!Remove(state, j)) return false;
+	first.op = (first.op & 0xFF00) | ((OP_NN(first.op) + OP_NN(next)) & 0xFF);
+	state.rewritten++;
+	return true;
+}
+
+// call X, ret -> jp X, ret. Same size, but the callee's ret now returns
+// straight to our caller, saving a ret and a stack level.
+static bool RuleTailCall(opt_state& state, uint i) {
+	opt_item& item = state.items[i];
+	if (OP_TOP(item.op) != 0x2) return false;
+	int j = NextKept(state, i);
+	if (j < 0 || !state.items[j].code || state.items[j].op != 0x00EE) return false;
+	item.op = 0x1000 | (item.op & 0x0FFF);
+	state.rewritten++;
+	return true;
+}
+
+// Follows a chain of jps from target to where it finally lands. Gives back
+// target itself if the chain loops or runs longer than OPT_MAX_HOPS.
+static symbol* FinalTarget(const opt_state& state, symbol* target) {
+	symbol* current = target;
+	for (uint hops = 0; hops < OPT_MAX_HOPS; hops++) {
+		if (current->kind != SYMBOL_LABEL) return current;
+		int j = FirstKeptAt(state, current->value - CHIP8_MEMSTART);
+		if (j < 0) return current;
+		const opt_item& item = state.items[j];
+		if (!item.code || OP_TOP(item.op) != 0x1 || item.fixup < 0) return current;
+		symbol* next = state.ctx.fixups[item.fixup].target;
+		if (next == current) return current;
+		current = next;
+	}
+	return target;
+}
+
+// jp/call X where X: jp Y -> jp/call Y
+static bool RuleThreadJump(opt_state& state, uint i) {
+	const opt_item& item = state.items[i];
+	if ((OP_TOP(item.op) != 0x1 && OP_TOP(item.op) != 0x2) || item.fixup < 0) return false;
+	fixup& fix = state.ctx.fixups[item.fixup];
+	symbol* destination = FinalTarget(state, fix.target);
+	if (destination == fix.target) return false;
+	fix.target = destination;
+	state.rewritten++;
+	return true;
+}
+
+// jp X where X: ret -> ret
+static bool RuleJumpToRet(opt_state& state, uint i) {
+	opt_item& item = state.items[i];
+	if (OP_TOP(item.op) != 0x1) return false;
+	int j = TargetItem(state, item);
+	if (j < 0 || !state.items[j].code || state.items[j].op != 0x00EE) return false;
+	item.op = 0x00EE;
+	item.fixup = -1;
+	state.rewritten++;
+	return true;
+}
+
+// call X where X: ret does nothing at all
+static bool RuleCallRet(opt_state& state, uint i) {
+	const opt_item& item = state.items[i];
+	if (OP_TOP(item.op) != 0x2) return false;
+	int j = TargetItem(state, item);
+	if (j < 0 || !state.items[j].code || state.items[j].op != 0x00EE) return false;
+	return Remove(state, i);
+}
+
+// se ..., jp over, <instruction>, over: -> sne ..., <instruction>
+// Not when the skip is itself skipped: that would then skip <instruction>
+// as well, where it used to land on it through the jp.
+static bool RuleInvertSkip(opt_state& state, uint i) {
+	opt_item& skip = state.items[i];
+	if (!state.movable || !IsSkip(skip.op) || skip.after_skip) return false;
+	int j = NextKept(state, i);
+	if (j < 0 || !state.items[j].code || state.items[j].labelled || state.items[j].in_table || OP_TOP(state.items[j].op) != 0x1) return false;
+	int k = NextKept(state, j);
+	if (k < 0 || !state.items[k].code) return false;
+	int target = TargetItem(state, state.items[j]);
+	if (target < 0 || target != NextKept(state, k)) return false;
+
+	switch (OP_TOP(skip.op)) {
+	case 0x3: case 0x4: skip.op ^= 0x7000; break;	/* se <-> sne, NN */
+	case 0x5: case 0x9: skip.op ^= 0xC000; break;	/* se <-> sne, Vy */
+	case 0xE: skip.op = (skip.op & 0xFF00) | (OP_NN(skip.op) == 0x9E ? 0xA1 : 0x9E); break;
+	}
+	//Once inverted, the skip lands on k rather than the jp
+	state.items[j].after_skip = false;
+	Remove(state, j);
+	state.items[k].after_skip = true;
+	state.rewritten++;
+	return true;
+}
+
+// Names a region by its label, or the nearest label before it
+static std::string RegionName(const opt_state& state, uint offset) {
+	auto label = state.labels.upper_bound(offset);
+	char name[16];
+	if (label == state.labels.begin()) {
+		snprintf(name, sizeof(name), "0x%03X", CHIP8_MEMSTART + offset);
+		return name;
+	}
+	label--;
+	if (label->first == offset) return std::string(label->second);
+	snprintf(name, sizeof(name), "+0x%X", offset - label->first);
+	return std::string(label->second) + name;
+}
+
+// Basic blocks over the items still in the ROM. item_of maps nodes back to
+// items. Returns false if nothing is left.
+static bool KeptGraph(const opt_state& state, cfg_graph& graph, std::vector<uint>& item_of) {
+	for (uint i = 0; i < state.items.size(); i++) {
+		const opt_item& item = state.items[i];
+		if (item.removed) continue;
+		int target = TargetItem(state, item);
+		graph.nodes.push_back({ item.offset, item.size, item.code, item.op, (target >= 0) ? (int)state.items[target].offset : -1, item.entries });
+		item_of.push_back(i);
+	}
+	if (graph.nodes.empty()) return false;
+	CFG_Build(graph);
+	return true;
+}
+
+/*
+	Strips the code and data nothing can reach. Code is reachable from the
+	entry point by falling through, skipping, jp and call. Anything a
+	reachable instruction refers to (jp, call, ld i, or a dw in kept data)
+	is reachable too. Data is kept from a referenced label to the end of its
+	run of data, since add i can walk from one sprite into the next. An
+	object's labels may be used by other modules, so they all count.
+	Unreachable code can't follow a reachable skip, so unlike Remove this
+	can take instructions right after a skip.
+*/
+static uint StripUnreachable(opt_state& state) {
+	if (!state.movable) return 0;
+	cfg_graph graph;
+	std::vector<uint> item_of;
+	if (!KeptGraph(state, graph, item_of)) return 0;
+
+	std::vector<bool> live(graph.nodes.size(), false);
+	std::vector<uint> pending = { 0 };
+	for (uint n = 0; n < graph.nodes.size(); n++) {
+		if (state.ctx.options.relocatable && state.items[item_of[n]].labelled) pending.push_back(n);
+	}
+	while (!pending.empty()) {
+		uint n = pending.back();
+		pending.pop_back();
+		if (live[n]) continue;
+		std::vector<uint> reached;
+		if (graph.nodes[n].code) {
+			const cfg_block& block = graph.blocks[graph.block_of[n]];
+			for (uint b = block.first; b < block.first + block.count; b++) reached.push_back(b);
+			for (const cfg_edge& edge : block.successors) pending.push_back(graph.blocks[edge.block].first);
+		}
+		else {
+			for (uint d = n; d < graph.nodes.size() && !graph.nodes[d].code; d++) reached.push_back(d);
+		}
+		for (uint r : reached) {
+			live[r] = true;
+			if (graph.nodes[r].target < 0) continue;
+			int target = CFG_NodeAt(graph, graph.nodes[r].target);
+			if (target >= 0) pending.push_back(target);
+		}
+	}
+
+	uint removed = 0;
+	for (uint n = 0; n < graph.nodes.size(); n++) {
+		if (live[n]) continue;
+		opt_item& item = state.items[item_of[n]];
+		const emitted_block& block = state.ctx.emitted[item_of[n]];
+		bool joins = n > 0 && !live[n - 1] && graph.nodes[n - 1].code == item.code && !item.labelled;
+		if (joins) state.stripped.back().bytes += item.size;
+		else state.stripped.push_back({ RegionName(state, item.offset), item.code, item.size, block.file, block.line });
+		item.removed = true;
+		if (item.code) state.removed++;
+		removed++;
+	}
+	return removed;
+}
+
+static const peephole_rule rule_table[] = {
+	{ "ld vx vx",     RuleLoadSelf },
+	{ "add vx 0",     RuleAddZero  },
+	{ "jp next",      RuleJumpNext },
+	{ "ld i reload",  RuleReloadI  },
+	{ "dead ld",      RuleDeadLoad },
+	{ "add merge",    RuleMergeAdd },
+	{ "tail call",    RuleTailCall },
+	{ "jp thread",    RuleThreadJump },
+	{ "jp ret",       RuleJumpToRet },
+	{ "call ret",     RuleCallRet },
+	{ "skip invert",  RuleInvertSkip },
+};
+
+// Applies the rule table until nothing changes, stripping unreachable code
+// after every round
+static void RunRules(opt_state& state, uint* hits, uint* unreachable) {
+	bool changed = true;
+	for (uint round = 0; changed && round < OPT_MAX_ROUNDS; round++) {
+		changed = false;
+		for (uint i = 0; i < state.items.size(); i++) {
+			if (state.items[i].removed || !state.items[i].code) continue;
+			for (uint r = 0; r < RULE_COUNT; r++) {
+				if (state.items[i].removed) break;
+				if (rule_table[r].apply(state, i)) {
+					hits[r]++;
+					changed = true;
+				}
+			}
+		}
+		uint dead = StripUnreachable(state);
+		*unreachable += dead;
+		changed = changed || dead > 0;
+	}
+}
+
+/*****************************************/
+/*										 */
+/*				 OUTLINING				 */
+/*                                       */
+/*****************************************/
+// Return addresses on the stack past which nothing more can be called
+#define DEPTH_UNKNOWN VM_STACK_SIZE
+
+struct outline_candidate {
+	uint length;				/* Instructions, not counting the ret */
+	std::vector<uint> starts;	/* Where each copy begins, as indexes into kept */
+	int saving;
+};
+
+struct outline_result {
+	uint sequences;
+	uint calls;
+	uint bytes;
+};
+
+/*
+	Return addresses on the stack while each item runs. A routine is the
+	entry point or a call target, plus everything it reaches without
+	following calls, and runs one deeper than the deepest routine calling it.
+	Recursion comes out as DEPTH_UNKNOWN, as does anything no routine reaches.
+*/
+static std::vector<uint> StackDepths(const opt_state& state) {
+	std::vector<uint> depth_of(state.items.size(), DEPTH_UNKNOWN);
+	cfg_graph graph;
+	std::vector<uint> item_of;
+	if (!KeptGraph(state, graph, item_of)) return depth_of;
+
+	std::map<uint, uint> routine_at = { { 0, 0 } };	/* Entry block -> routine */
+	for (const cfg_node& node : graph.nodes) {
+		if (!node.code || OP_TOP(node.op) != 0x2 || node.target < 0) continue;
+		int target = CFG_NodeAt(graph, node.target);
+		if (target >= 0) routine_at.emplace(graph.block_of[target], (uint)routine_at.size());
+	}
+
+	std::vector<std::vector<uint>> routines_of(graph.blocks.size());
+	std::vector<std::pair<uint, uint>> calls;	/* Caller, callee */
+	for (const auto& routine : routine_at) {
+		std::vector<bool> seen(graph.blocks.size(), false);
+		std::vector<uint> pending = { routine.first };
+		while (!pending.empty()) {
+			uint b = pending.back();
+			pending.pop_back();
+			if (seen[b]) continue;
+			seen[b] = true;
+			routines_of[b].push_back(routine.second);
+			for (const cfg_edge& edge : graph.blocks[b].successors) {
+				if (edge.kind == CFG_EDGE_CALL) calls.push_back({ routine.second, routine_at.find(edge.block)->second });
+				else pending.push_back(edge.block);
+			}
+		}
+	}
+
+	//Depths only grow and stop at DEPTH_UNKNOWN, so a cycle can't loop forever
+	std::vector<int> depth(routine_at.size(), -1);
+	depth[0] = 0;
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (const auto& call : calls) {
+			if (depth[call.first] < 0) continue;
+			int deeper = std::min(depth[call.first] + 1, DEPTH_UNKNOWN);
+			if (deeper <= depth[call.second]) continue;
+			depth[call.second] = deeper;
+			changed = true;
+		}
+	}
+
+	for (uint n = 0; n < graph.nodes.size(); n++) {
+		int deepest = -1;
+		for (uint r : routines_of[graph.block_of[n]]) deepest = std::max(deepest, depth[r]);
+		if (deepest >= 0) depth_of[item_of[n]] = deepest;
+	}
+	return depth_of;
+}
+
+// Can the item be part of an outlined sequence? Control flow stays where it
+// is. Only the first instruction may be jumped to, since the call takes its
+// place, and it can't follow a skip, which would then skip the whole copy.
+static bool Outlinable(const opt_item& item, bool first) {
+	if (item.removed || !item.code || item.outlined) return false;
+	uint top = OP_TOP(item.op);
+	if ((top == 0x0 && item.op != 0x00E0) || top == 0x1 || top == 0x2 || top == 0xB || IsSkip(item.op)) return false;
+	return first ? !item.after_skip : !item.labelled;
+}
+
+// Equal instructions get equal keys; an ld i is told apart by its label
+static unsigned long long ItemKey(const opt_state& state, const opt_item& item) {
+	unsigned long long key = item.op + 1;
+	if (item.fixup >= 0) key ^= (unsigned long long)(uintptr_t)state.ctx.fixups[item.fixup].target << 16;
+	return key;
+}
+
+static bool SameSequence(const opt_state& state, const std::vector<uint>& kept, uint a, uint b, uint length) {
+	for (uint t = 0; t < length; t++) {
+		const opt_item& first = state.items[kept[a + t]];
+		const opt_item& second = state.items[kept[b + t]];
+		if (first.op != second.op || !SameTarget(state, first, second)) return false;
+	}
+	return true;
+}
+
+// Bytes saved by replacing every copy with a call to one copy plus a ret
+static int OutlineSaving(uint length, uint copies) {
+	return INSTRUCTION_SIZE * ((int)(copies * length) - (int)copies - (int)length - 1);
+}
+
+// Appends one copy of the sequence and a ret after everything else, then
+// turns the first instruction of every copy into a call to it
+static void Outline(opt_state& state, const std::vector<uint>& kept, const outline_candidate& candidate) {
+	asm_context& ctx = state.ctx;
+	char name[32];
+	for (uint n = 0;; n++) {
+		snprintf(name, sizeof(name), "outlined_%u", n);
+		if (SYM_Find(ctx.symbols, name) == nullptr) break;
+	}
+	symbol* sym = SYM_Intern(ctx.symbols, name);
+	sym->kind = SYMBOL_LABEL;
+	sym->value = CHIP8_MEMSTART + state.tail;
+	sym->type = TYPE_LITERAL;
+	sym->bitcount = LITERAL_12;
+	state.labels.emplace(state.tail, sym->name);
+
+	for (uint t = 0; t <= candidate.length; t++) {
+		bool ret = t == candidate.length;
+		uint from = kept[candidate.starts[0] + (ret ? t - 1 : t)];
+		opt_item item = state.items[from];
+		emitted_block block = ctx.emitted[from];
+		item.offset = block.offset = state.tail;
+		item.labelled = t == 0;
+		item.after_skip = false;
+		item.outlined = true;
+		if (ret) {
+			item.op = 0x00EE;
+			item.fixup = -1;
+		}
+		else if (item.fixup >= 0) {
+			fixup copy = ctx.fixups[item.fixup];
+			copy.offset = state.tail;
+			ctx.fixups.push_back(copy);
+			item.fixup = (int)ctx.fixups.size() - 1;
+		}
+		state.items.push_back(item);
+		ctx.emitted.push_back(block);
+		state.tail += INSTRUCTION_SIZE;
+	}
+
+	for (uint start : candidate.starts) {
+		opt_item& call = state.items[kept[start]];
+		const emitted_block& block = ctx.emitted[kept[start]];
+		ctx.fixups.push_back({ call.offset, FIXUP_NNN, sym, block.file, block.line });
+		call.op = 0x2000;
+		call.fixup = (int)ctx.fixups.size() - 1;
+		for (uint t = 1; t < candidate.length; t++) state.items[kept[start + t]].removed = true;
+	}
+}
+
+/*
+	Moves instruction sequences repeated across the ROM into subroutines of
+	their own, after everything else, replacing each copy with a call. Every
+	window of up to OPT_MAX_OUTLINE instructions is hashed, and the sequence
+	saving the most bytes goes first, until none saves anything. Copies where
+	a call would overflow the stack are left alone.
+*/
+static void OutlineSequences(opt_state& state, outline_result* result) {
+	std::vector<uint> depth_of = StackDepths(state);
+	for (;;) {
+		std::vector<uint> kept;
+		for (uint i = 0; i < state.items.size(); i++) {
+			if (!state.items[i].removed) kept.push_back(i);
+		}
+		//run[k] is how many instructions from kept[k] on could form a sequence
+		uint count = (uint)kept.size();
+		std::vector<uint> follow(count + 1, 0), run(count, 0);
+		for (uint k = count; k-- > 0;) {
+			const opt_item& item = state.items[kept[k]];
+			follow[k] = Outlinable(item, false) ? follow[k + 1] + 1 : 0;
+			bool room = kept[k] < depth_of.size() && depth_of[kept[k]] < VM_STACK_SIZE;
+			run[k] = (room && Outlinable(item, true)) ? follow[k + 1] + 1 : 0;
+		}
+		std::vector<unsigned long long> prefix(count + 1, 0), power(count + 1, 1);
+		for (uint k = 0; k < count; k++) {
+			prefix[k + 1] = prefix[k] * 0x100000001B3ULL + ItemKey(state, state.items[kept[k]]);
+			power[k + 1] = power[k] * 0x100000001B3ULL;
+		}
+
+		outline_candidate best = { 0, {}, 0 };
+		for (uint length = 2; length <= OPT_MAX_OUTLINE; length++) {
+			std::unordered_map<unsigned long long, std::vector<uint>> windows;
+			for (uint k = 0; k + length <= count; k++) {
+				if (run[k] >= length) windows[prefix[k + length] - prefix[k] * power[length]].push_back(k);
+			}
+			if (windows.empty()) break;
+			for (const auto& window : windows) {
+				if (window.second.size() < 2) continue;
+				//Copies may overlap, and hashes collide, so take the ones that fit
+				std::vector<uint> starts;
+				for (uint k : window.second) {
+					if (!starts.empty() && (k < starts.back() + length || !SameSequence(state, kept, starts[0], k, length))) continue;
+					starts.push_back(k);
+				}
+				int saving = OutlineSaving(length, (uint)starts.size());
+				if (saving <= 0) continue;
+				//Ties go to the earliest copy, so the ROM doesn't depend on hash order
+				if (saving > best.saving || (saving == best.saving && starts[0] < best.starts[0]))
+					best = { length, starts, saving };
+			}
+		}
+		if (best.saving <= 0) return;
+		Outline(state, kept, best);
+		result->sequences++;
+		result->calls += (uint)best.starts.size();
+		result->bytes += best.saving;
+	}
+}
+
+/*****************************************/
+/*										 */
+/*			   DATA PACKING				 */
+/*                                       */
+/*****************************************/
+// A run of data between instructions. add i and multi-row draws may step
+// from one of its labels into the next, so it only moves as a whole.
+struct data_block {
+	uint first;		/* Item range */
+	uint count;
+	std::string bytes;
+	int parent;		/* Block this one lies inside of, or -1 */
+	uint position;	/* Offset into the parent, or into state.packed */
+};
+
+struct pack_result {
+	uint blocks;
+	uint duplicates;	/* Found whole inside another block */
+	uint overlaps;
+	uint bytes;
+};
+
+static uint Overlap(const std::string& before, const std::string& after) {
+	for (uint length = (uint)std::min(before.size(), after.size()) - 1; length > 0; length--) {
+		if (before.compare(before.size() - length, length, after, 0, length) == 0) return length;
+	}
+	return 0;
+}
+
+static uint ChainRoot(std::vector<uint>& chain, uint b) {
+	while (chain[b] != b) b = chain[b] = chain[chain[b]];
+	return b;
+}
+
+/*
+	Finds which items bcd and ld i vx may write to. Walks back from each
+	store to the ld i that set I, through add i. Returns false, with the
+	store, if I could have been set anywhere else.
+*/
+static bool WrittenData(const opt_state& state, const std::vector<uint>& kept, std::vector<bool>& written, uint* store) {
+	for (uint k = 0; k < kept.size(); k++) {
+		const opt_item& item = state.items[kept[k]];
+		if (!item.code || OP_TOP(item.op) != 0xF || (OP_NN(item.op) != 0x33 && OP_NN(item.op) != 0x55)) continue;
+		*store = kept[k];
+		for (uint j = k;; j--) {
+			if (j == 0 || state.items[kept[j]].labelled || state.items[kept[j]].after_skip) return false;
+			const opt_item& prev = state.items[kept[j - 1]];
+			if (!prev.code) return false;
+			uint top = OP_TOP(prev.op);
+			if ((top == 0x0 && prev.op != 0x00E0) || top == 0x1 || top == 0x2 || top == 0xB) return false;
+			if (top == 0xA) {
+				int target = TargetItem(state, prev);
+				if (target >= 0) written[target] = true;
+				break;
+			}
+			//fnt points I at the font, which isn't ours to move
+			if (top == 0xF && OP_NN(prev.op) == 0x29) break;
+		}
+	}
+	return true;
+}
+
+/*
+	Moves every run of data into one packed run after everything else. Runs
+	equal to, or found inside, another run share its bytes, and the rest are
+	chained greedily by the longest overlap of one's end with another's
+	start. Runs holding an address (dw label), runs bcd or ld i vx may write
+	to, and runs that don't start at a label stay put.
+*/
+static void PackData(opt_state& state, pack_result* result) {
+	asm_context& ctx = state.ctx;
+	std::vector<uint> kept;
+	for (uint i = 0; i < state.items.size(); i++) {
+		if (!state.items[i].removed) kept.push_back(i);
+	}
+	std::vector<bool> written(state.items.size(), false);
+	uint store = 0;
+	if (!WrittenData(state, kept, written, &store)) {
+		const emitted_block& block = ctx.emitted[store];
+		PushMessage(ctx, "Data left unpacked: can't tell what the store at \"%s\" line %i writes to.\n",
+					ctx.source_files[block.file].c_str(), block.line);
+		return;
+	}
+
+	std::vector<data_block> blocks;
+	for (uint k = 0; k < kept.size(); k++) {
+		const opt_item& item = state.items[kept[k]];
+		if (item.code) continue;
+		bool starts = k == 0 || state.items[kept[k - 1]].code;
+		if (starts) blocks.push_back({ kept[k], 0, "", -1, 0 });
+		data_block& block = blocks.back();
+		block.count = kept[k] - block.first + 1;
+		block.bytes.append(ctx.rom_output + item.offset, item.size);
+	}
+	uint before = 0;
+	for (uint b = 0; b < blocks.size();) {
+		bool movable = state.items[blocks[b].first].labelled;
+		for (uint i = blocks[b].first; i < blocks[b].first + blocks[b].count && movable; i++)
+			movable = state.items[i].removed || (state.items[i].fixup < 0 && !written[i]);
+		if (movable) before += (uint)blocks[b++].bytes.size();
+		else blocks.erase(blocks.begin() + b);
+	}
+	if (blocks.size() < 2) return;
+
+	//Longest first, so a block can only lie inside one already seen
+	std::vector<uint> order(blocks.size());
+	for (uint b = 0; b < order.size(); b++) order[b] = b;
+	std::stable_sort(order.begin(), order.end(),
+					 [&](uint a, uint b) { return blocks[a].bytes.size() > blocks[b].bytes.size(); });
+	std::vector<uint> roots;
+	for (uint b : order) {
+		for (uint r : roots) {
+			size_t at = blocks[r].bytes.find(blocks[b].bytes);
+			if (at == std::string::npos) continue;
+			blocks[b].parent = r;
+			blocks[b].position = (uint)at;
+			result->duplicates++;
+			break;
+		}
+		if (blocks[b].parent < 0) roots.push_back(b);
+	}
+	std::sort(roots.begin(), roots.end());
+
+	struct overlap_edge { uint length, from, to; };
+	std::vector<overlap_edge> edges;
+	for (uint from : roots) {
+		for (uint to : roots) {
+			uint length = (from == to) ? 0 : Overlap(blocks[from].bytes, blocks[to].bytes);
+			if (length > 0) edges.push_back({ length, from, to });
+		}
+	}
+	std::stable_sort(edges.begin(), edges.end(),
+					 [](const overlap_edge& a, const overlap_edge& b) { return a.length > b.length; });
+	std::vector<int> next(blocks.size(), -1), joined(blocks.size(), 0);
+	std::vector<bool> has_prev(blocks.size(), false);
+	std::vector<uint> chain(blocks.size());
+	for (uint b = 0; b < chain.size(); b++) chain[b] = b;
+	for (const overlap_edge& edge : edges) {
+		if (next[edge.from] >= 0 || has_prev[edge.to] || ChainRoot(chain, edge.from) == ChainRoot(chain, edge.to)) continue;
+		next[edge.from] = edge.to;
+		joined[edge.to] = edge.length;
+		has_prev[edge.to] = true;
+		chain[ChainRoot(chain, edge.to)] = ChainRoot(chain, edge.from);
+		result->overlaps++;
+	}
+
+	std::string packed;
+	for (uint r : roots) {
+		if (has_prev[r]) continue;
+		for (int b = r; b >= 0; b = next[b]) {
+			blocks[b].position = (uint)packed.size() - joined[b];
+			packed.append(blocks[b].bytes, joined[b], std::string::npos);
+		}
+	}
+	if (packed.size() >= before) {
+		result->duplicates = result->overlaps = 0;
+		return;
+	}
+
+	//Labels move before the items go, while they still land on the runs,
+	//each keeping its place within its run
+	std::map<uint, uint> moved;	/* Item -> offset in packed */
+	for (const data_block& block : blocks) {
+		uint position = block.position;
+		if (block.parent >= 0) position += blocks[block.parent].position;
+		for (uint i = block.first; i < block.first + block.count; i++) {
+			if (state.items[i].removed) continue;
+			moved[i] = position;
+			position += state.items[i].size;
+		}
+	}
+	for (symbol* sym : ctx.symbols.records) {
+		if (sym->kind != SYMBOL_LABEL) continue;
+		auto found = moved.find(FirstKeptAt(state, sym->value - CHIP8_MEMSTART));
+		if (found != moved.end()) sym->value = CHIP8_MEMSTART + state.tail + found->second;
+	}
+	for (const data_block& block : blocks) {
+		for (uint i = block.first; i < block.first + block.count; i++) state.items[i].removed = true;
+	}
+
+	opt_item item = {};
+	item.offset = state.tail;
+	item.size = (uint)packed.size();
+	item.fixup = -1;
+	item.labelled = true;
+	item.packed = true;
+	emitted_block block = ctx.emitted[blocks[0].first];
+	block.offset = state.tail;
+	block.size = item.size;
+	state.items.push_back(item);
+	ctx.emitted.push_back(block);
+	state.tail += item.size;
+	state.packed.swap(packed);
+	result->blocks = (uint)blocks.size();
+	result->bytes = before - item.size;
+}
+
+/*****************************************/
+/*										 */
+/*				 LAYOUT					 */
+/*                                       */
+/*****************************************/
+// Returns false (and why) if an address the optimizer can't follow is in the ROM
+static bool Movable(const opt_state& state, const char** reason, uint* item_index) {
+	for (uint i = 0; i < state.items.size(); i++) {
+		const opt_item& item = state.items[i];
+		if (!item.code) continue;
+		*item_index = i;
+		uint top = OP_TOP(item.op);
+		if (top == 0xB && item.entries == 0) {
+			*reason = "a jp v0 table";
+			return false;
+		}
+		if ((top == 0x1 || top == 0x2 || top == 0xA) && item.fixup < 0) {
+			*reason = "a literal address";
+			return false;
+		}
+		if (top == 0x0 && item.op != 0x00E0 && item.op != 0x00EE) {
+			*reason = "a machine code call";
+			return false;
+		}
+	}
+	return true;
+}
+
+// Where old_offset ends up once the removed items are gone
+static uint NewOffset(const opt_state& state, const std::vector<uint>& removed_before, uint old_offset) {
+	auto next = std::lower_bound(state.items.begin(), state.items.end(), old_offset,
+								 [](const opt_item& item, uint offset) { return item.offset < offset; });
+	return old_offset - removed_before[next - state.items.begin()];
+}
+
+static void Compact(opt_state& state) {
+	asm_context& ctx = state.ctx;
+	std::vector<uint> removed_before(state.items.size() + 1, 0);
+	for (uint i = 0; i < state.items.size(); i++)
+		removed_before[i + 1] = removed_before[i] + (state.items[i].removed ? state.items[i].size : 0);
+
+	for (symbol* sym : ctx.symbols.records) {
+		if (sym->kind == SYMBOL_LABEL) sym->value = CHIP8_MEMSTART + NewOffset(state, removed_before, sym->value - CHIP8_MEMSTART);
+	}
+
+	std::vector<fixup> fixups;
+	std::vector<emitted_block> emitted;
+	std::vector<jump_table> jump_tables;
+	char output[ROM_STAGING_SIZE];
+	uint index = 0;
+	for (uint i = 0; i < state.items.size(); i++) {
+		const opt_item& item = state.items[i];
+		if (item.removed) continue;
+		if (item.fixup >= 0) {
+			fixups.push_back(ctx.fixups[item.fixup]);
+			fixups.back().offset = index;
+		}
+		emitted.push_back(ctx.emitted[i]);
+		emitted.back().offset = index;
+		if (item.entries > 0) jump_tables.push_back({ index, item.entries });
+		if (item.code) {
+			output[index] = item.op >> 8;
+			output[index + 1] = item.op & 0xFF;
+		}
+		else if (item.packed) std::memcpy(output + index, state.packed.data(), item.size);
+		else std::memcpy(output + index, ctx.rom_output + item.offset, item.size);
+		index += item.size;
+	}
+	std::memcpy(ctx.rom_output, output, index);
+	std::memset(ctx.rom_output + index, 0, sizeof(ctx.rom_output) - index);
+	ctx.rom_index = index;
+	ctx.fixups.swap(fixups);
+	ctx.emitted.swap(emitted);
+	ctx.jump_tables.swap(jump_tables);
+}
+
+void OPT_Optimize(asm_context& ctx) {
+	//Bytes past the staging buffer were never stored, so there is nothing to work on
+	if (ctx.byte_overflow != 0) return;
+
+	opt_state state = { ctx };
+	std::map<uint, int> fixup_at;
+	for (uint f = 0; f < ctx.fixups.size(); f++) fixup_at[ctx.fixups[f].offset] = f;
+	std::vector<bool> labelled(ROM_STAGING_SIZE + 1, false);
+	for (const symbol* sym : ctx.symbols.records) {
+		if (sym->kind != SYMBOL_LABEL) continue;
+		labelled[sym->value - CHIP8_MEMSTART] = true;
+		state.labels.emplace(sym->value - CHIP8_MEMSTART, sym->name);
+	}
+
+	uint expected = 0;
+	for (const emitted_block& block : ctx.emitted) {
+		//Every byte should have come from a recorded line; if not, leave the ROM be
+		if (block.offset != expected) return;
+		expected += block.size;
+		opt_item item = {};
+		item.offset = block.offset;
+		item.size = block.size;
+		item.code = block.code && block.size == INSTRUCTION_SIZE;
+		if (item.code) item.op = ((byte)ctx.rom_output[block.offset] << 8) | (byte)ctx.rom_output[block.offset + 1];
+		auto fix = fixup_at.find(block.offset);
+		item.fixup = (fix != fixup_at.end()) ? fix->second : -1;
+		item.labelled = labelled[block.offset];
+		if (!state.items.empty()) item.after_skip = state.items.back().code && IsSkip(state.items.back().op);
+		state.items.push_back(item);
+	}
+	if (expected != ctx.rom_index) return;
+	state.tail = expected;
+	for (const jump_table& table : ctx.jump_tables) {
+		int at = FirstKeptAt(state, table.offset);
+		if (at < 0 || state.items[at].offset != table.offset) continue;
+		state.items[at].entries = table.entries;
+		for (uint k = 1; k <= table.entries && at + k < state.items.size(); k++) state.items[at + k].in_table = true;
+	}
+
+	const char* reason = "";
+	uint reason_item = 0;
+	state.movable = Movable(state, &reason, &reason_item);
+	if (!state.movable) {
+		const emitted_block& block = ctx.emitted[reason_item];
+		PushMessage(ctx, "Optimizer kept the layout: %s at \"%s\" line %i.\n",
+					reason, ctx.source_files[block.file].c_str(), block.line);
+	}
+
+	uint hits[RULE_COUNT] = { 0 };
+	uint unreachable = 0;
+	RunRules(state, hits, &unreachable);
+	outline_result outlined = {};
+	pack_result packed = {};
+	//Other modules may call into an object at any depth, or write to its data
+	if (ctx.options.outline && state.movable && !ctx.options.relocatable) {
+		OutlineSequences(state, &outlined);
+		if (outlined.sequences > 0) RunRules(state, hits, &unreachable);
+		//Last, since the rules can't follow labels into the packed run
+		PackData(state, &packed);
+	}
+
+	uint start_size = ctx.rom_index;
+	Compact(state);
+
+	std::string detail;
+	for (uint r = 0; r < RULE_COUNT; r++) {
+		if (hits[r] == 0) continue;
+		char count[64];
+		snprintf(count, sizeof(count), "%s%s x%u", detail.empty() ? "" : ", ", rule_table[r].name, hits[r]);
+		detail += count;
+	}
+	if (unreachable > 0) {
+		char count[64];
+		snprintf(count, sizeof(count), "%sunreachable x%u", detail.empty() ? "" : ", ", unreachable);
+		detail += count;
+	}
+	PushMessage(ctx, "Optimized: removed %i instruction(s), rewrote %i, saving %i bytes%s%s%s.\n",
+				state.removed, state.rewritten, start_size - ctx.rom_index,
+				detail.empty() ? "" : " (", detail.c_str(), detail.empty() ? "" : ")");
+	if (outlined.sequences > 0) {
+		PushMessage(ctx, "Outlined %i repeated sequence(s) into subroutines, replacing %i copies with calls and saving %i bytes.\n",
+					outlined.sequences, outlined.calls, outlined.bytes);
+	}
+	if (packed.blocks > 0) {
+		PushMessage(ctx, "Packed %i data run(s) (%i found inside others, %i overlapped), saving %i bytes.\n",
+					packed.blocks, packed.duplicates, packed.overlaps, packed.bytes);
+	}
+	if (state.stripped.empty()) return;
+	uint stripped_bytes = 0;
+	for (const stripped_region& region : state.stripped) stripped_bytes += region.bytes;
+	PushMessage(ctx, "Stripped %i unreachable region(s), freeing %i bytes:\n", (uint)state.stripped.size(), stripped_bytes);
+	for (const stripped_region& region : state.stripped) {
+		PushMessage(ctx, "   %-24s %s, %4i bytes  (\"%s\" line %i)\n", region.name.c_str(), region.code ? "code" : "data",
+					region.bytes, ctx.source_files[region.file].c_str(), region.line);
+	}
+}
@@ -0,0 +1,39 @@
+#ifndef CBA_OPTIMIZE_H
+#define CBA_OPTIMIZE_H
+#pragma once
+#include "stdafx.h"
+#include "context.h"
+
+// Rounds of the rule table before giving up on reaching a fixed point
+#define OPT_MAX_ROUNDS 16
+// Longest jp chain followed when threading jumps
+#define OPT_MAX_HOPS 16
+// Longest instruction sequence -Os will move into a subroutine
+#define OPT_MAX_OUTLINE 32
+
+/*
+	Peephole optimizer, run between the first and second passes (-O). Works
+	on the instructions recorded in ctx.emitted, removing or rewriting them
+	by the rules in optimize.cpp, then compacts rom_output and moves every
+	label and fixup along with the code. Needs every label reference to be a
+	fixup, which DeferLabels arranges while options.optimize is set.
+
+	Jump threading retargets jp/call at their final destination. After each
+	round of rules, code nothing can reach and data nothing refers to (see
+	StripUnreachable) are stripped, and listed in the report.
+
+	Instructions right after a skip are never removed, since the skip would
+	then land on something else. If the ROM holds an address the optimizer
+	can't move (a literal jp/call/ld i address, or a jp v0 table not made by
+	.switch) nothing is removed, and only the rewrites that keep the layout
+	are applied. A .switch table's entries are never removed.
+
+	With options.outline (-Os), instruction sequences repeated often enough
+	to pay for a call and ret are then moved into subroutines at the end of
+	the ROM (see OutlineSequences), as long as every call site has room left
+	on the 16-level stack. The ROM is staged in a buffer larger than
+	MAX_ROMSIZE while this runs, so a ROM may start out over the limit.
+*/
+void OPT_Optimize(asm_context& ctx);
+
+#endif
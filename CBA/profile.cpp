@@ -0,0 +1,166 @@
+#include "profile.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+struct routine_row {
+	int label;
+	unsigned long long self;
+	unsigned long long total;
+	unsigned long long sprite_rows;
+	bool called;
+};
+
+void PROFILE_Begin(vm_profile& profile) {
+	std::memset(profile.instructions, 0, sizeof(profile.instructions));
+	std::memset(profile.sprite_rows, 0, sizeof(profile.sprite_rows));
+	profile.nodes.clear();
+	profile.children.clear();
+	profile.nodes.push_back({ 0, CHIP8_MEMSTART, 0, 0 });
+	profile.current = 0;
+	profile.runs = 0;
+	profile.frames = 0;
+}
+
+static uint ChildNode(vm_profile& profile, uint parent, uint address) {
+	unsigned long long key = ((unsigned long long)parent << 32) | address;
+	auto found = profile.children.emplace(key, (uint)profile.nodes.size());
+	if (found.second) profile.nodes.push_back({ parent, address, 0, 0 });
+	return found.first->second;
+}
+
+void PROFILE_Step(vm_profile& profile, uint pc, word op) {
+	uint rows = ((op >> 12) == 0xD) ? (op & 0xF) : 0;
+	profile.instructions[pc]++;
+	profile.sprite_rows[pc] += rows;
+	//The call and ret themselves count towards the caller and callee
+	profile_node& node = profile.nodes[profile.current];
+	node.instructions++;
+	node.sprite_rows += rows;
+	if ((op >> 12) == 0x2) profile.current = ChildNode(profile, profile.current, op & 0xFFF);
+	else if (op == 0x00EE) profile.current = profile.nodes[profile.current].parent;
+}
+
+void PROFILE_Merge(vm_profile& into, const vm_profile& from) {
+	for (uint a = 0; a < CHIP8_MEMSIZE; a++) {
+		into.instructions[a] += from.instructions[a];
+		into.sprite_rows[a] += from.sprite_rows[a];
+	}
+	//Parents are always created before their children
+	std::vector<uint> mapped(from.nodes.size());
+	for (uint n = 0; n < from.nodes.size(); n++) {
+		const profile_node& node = from.nodes[n];
+		mapped[n] = (n == 0) ? 0 : ChildNode(into, mapped[node.parent], node.address);
+		into.nodes[mapped[n]].instructions += node.instructions;
+		into.nodes[mapped[n]].sprite_rows += node.sprite_rows;
+	}
+	into.runs += from.runs;
+	into.frames += from.frames;
+}
+
+std::vector<profile_label> PROFILE_Labels(const symbol_table& symbols) {
+	std::vector<profile_label> labels;
+	for (const symbol* sym : symbols.records) {
+		if (sym->kind == SYMBOL_LABEL && !SYM_Generated(sym)) labels.push_back({ sym->value, std::string(sym->name) });
+	}
+	std::stable_sort(labels.begin(), labels.end(),
+					 [](const profile_label& a, const profile_label& b) { return a.address < b.address; });
+	return labels;
+}
+
+// Index of the label an address falls under, or -1 if it is before every label
+static int LabelIndex(const std::vector<profile_label>& labels, uint address) {
+	auto after = std::upper_bound(labels.begin(), labels.end(), address,
+								  [](uint a, const profile_label& label) { return a < label.address; });
+	return (int)(after - labels.begin()) - 1;
+}
+
+static std::string LabelName(const std::vector<profile_label>& labels, int label) {
+	if (label >= 0) return labels[label].name;
+	char name[16];
+	snprintf(name, sizeof(name), "0x%03X", CHIP8_MEMSTART);
+	return name;
+}
+
+static std::string FrameName(const std::vector<profile_label>& labels, uint address) {
+	int label = LabelIndex(labels, address);
+	if (label >= 0 && labels[label].address == address) return labels[label].name;
+	char offset[16];
+	if (label < 0) {
+		snprintf(offset, sizeof(offset), "0x%03X", address);
+		return offset;
+	}
+	snprintf(offset, sizeof(offset), "+0x%X", address - labels[label].address);
+	return labels[label].name + offset;
+}
+
+void PROFILE_Report(const vm_profile& profile, const std::vector<profile_label>& labels, std::string name, FILE* out) {
+	std::map<int, routine_row> rows;
+	unsigned long long instructions = 0;
+	for (uint a = 0; a < CHIP8_MEMSIZE; a++) {
+		if (profile.instructions[a] == 0) continue;
+		int label = LabelIndex(labels, a);
+		routine_row& row = rows.emplace(label, routine_row{ label, 0, 0, 0, false }).first->second;
+		row.self += profile.instructions[a];
+		row.sprite_rows += profile.sprite_rows[a];
+		instructions += profile.instructions[a];
+	}
+
+	//Inclusive counts from the call tree. A routine already on the stack
+	//(recursion) is only counted at its outermost call.
+	std::vector<unsigned long long> subtree(profile.nodes.size());
+	for (uint n = (uint)profile.nodes.size(); n-- > 0;) {
+		subtree[n] += profile.nodes[n].instructions;
+		if (n > 0) subtree[profile.nodes[n].parent] += subtree[n];
+	}
+	for (uint n = 0; n < profile.nodes.size(); n++) {
+		uint address = profile.nodes[n].address;
+		bool outermost = true;
+		for (uint p = n; p > 0 && outermost;) {
+			p = profile.nodes[p].parent;
+			outermost = profile.nodes[p].address != address;
+		}
+		if (!outermost) continue;
+		int label = LabelIndex(labels, address);
+		routine_row& row = rows.emplace(label, routine_row{ label, 0, 0, 0, false }).first->second;
+		row.total += subtree[n];
+		row.called = true;
+	}
+
+	std::vector<routine_row> sorted;
+	for (const auto& row : rows) sorted.push_back(row.second);
+	std::stable_sort(sorted.begin(), sorted.end(),
+					 [](const routine_row& a, const routine_row& b) { return a.self > b.self; });
+
+	double frames = profile.frames ? (double)profile.frames : 1.0;
+	double percent = instructions ? 100.0 / instructions : 0.0;
+	fprintf(out, "\nProfile of \"%s\": %u run(s), %llu frames, %llu instructions (%.1f/frame)\n",
+			name.c_str(), profile.runs, profile.frames, instructions, instructions / frames);
+	fprintf(out, "  %12s %7s %12s %7s %10s %11s  %s\n", "Self", "%", "Total", "%", "Per frame", "Sprite rows", "Routine");
+	for (uint r = 0; r < sorted.size() && r < PROFILE_REPORT_ROWS; r++) {
+		const routine_row& row = sorted[r];
+		std::string routine = LabelName(labels, row.label);
+		if (row.called) {
+			fprintf(out, "  %12llu %6.1f%% %12llu %6.1f%% %10.1f %11llu  %s\n", row.self, row.self * percent,
+					row.total, row.total * percent, row.total / frames, row.sprite_rows, routine.c_str());
+		}
+		else {
+			fprintf(out, "  %12llu %6.1f%% %12s %7s %10.1f %11llu  %s\n", row.self, row.self * percent,
+					"-", "", row.self / frames, row.sprite_rows, routine.c_str());
+		}
+	}
+	if (sorted.size() > PROFILE_REPORT_ROWS) fprintf(out, "  (%u more)\n", (uint)(sorted.size() - PROFILE_REPORT_ROWS));
+}
+
+bool PROFILE_WriteCollapsed(const vm_profile& profile, const std::vector<profile_label>& labels, std::string path) {
+	std::ofstream file(path, std::ofstream::binary);
+	if (!file.is_open()) return false;
+	std::vector<std::string> names(profile.nodes.size());
+	for (uint n = 0; n < profile.nodes.size(); n++) {
+		const profile_node& node = profile.nodes[n];
+		std::string frame = FrameName(labels, node.address);
+		names[n] = (n == 0) ? frame : names[node.parent] + ";" + frame;
+		if (node.instructions > 0) file << names[n] << ' ' << node.instructions << '\n';
+	}
+	return file.good();
+}
@@ -0,0 +1,55 @@
+#ifndef CBA_PROFILE_H
+#define CBA_PROFILE_H
+#pragma once
+#include "stdafx.h"
+#include "symbol.h"
+#include <stdio.h>
+
+#define PROFILE_EXTENSION ".folded"
+#define PROFILE_REPORT_ROWS 20
+
+// One distinct call stack: the routine called, and the stack it was called from
+struct profile_node {
+	uint parent;
+	uint address;	/* Call target; node 0 is the entry point */
+	unsigned long long instructions;
+	unsigned long long sprite_rows;
+};
+
+/*
+	Instruction and sprite row counts for every address, plus a call tree
+	built by following call/ret. Chip-8's 16-level stack keeps the tree small.
+*/
+struct vm_profile {
+	unsigned long long instructions[CHIP8_MEMSIZE];
+	unsigned long long sprite_rows[CHIP8_MEMSIZE];
+	std::vector<profile_node> nodes;
+	std::map<unsigned long long, uint> children;	/* (parent << 32 | address) -> node */
+	uint current;
+	uint runs;
+	unsigned long long frames;
+};
+
+struct profile_label {
+	uint address;
+	std::string name;
+};
+
+void PROFILE_Begin(vm_profile& profile);
+
+// Counts an instruction the machine has just executed at pc
+void PROFILE_Step(vm_profile& profile, uint pc, word op);
+
+void PROFILE_Merge(vm_profile& into, const vm_profile& from);
+
+// Every label in the table, sorted by address
+std::vector<profile_label> PROFILE_Labels(const symbol_table& symbols);
+
+// Prints the routines (label to next label) that executed the most instructions
+void PROFILE_Report(const vm_profile& profile, const std::vector<profile_label>& labels, std::string name, FILE* out = stdout);
+
+// Writes the call stacks in the collapsed format flame graph tools read,
+// one "main;update;draw_player <instructions>" line per stack.
+bool PROFILE_WriteCollapsed(const vm_profile& profile, const std::vector<profile_label>& labels, std::string path);
+
+#endif
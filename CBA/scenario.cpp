@@ -0,0 +1,363 @@
+#include "scenario.h"
+#include "assembler.h"
+#include "error.h"
+#include "lexer.h"
+#include "workpool.h"
+#include "profile.h"
+#include "link.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
+struct rom_image {
+	std::string path;						/* The first of paths, which names the ROM */
+	std::vector<std::string> paths;
+	bool optimize;
+	bool outline;
+	std::vector<byte> data;
+	std::unique_ptr<asm_context> failed;	/* Kept to print the assembler's errors */
+	bool loaded = false;
+	std::vector<profile_label> labels;
+	std::unique_ptr<vm_profile> profile;	/* Every profiled scenario merged together */
+};
+
+struct scenario_result {
+	bool passed = true;
+	uint status = VM_RUNNING;
+	uint frames = 0;
+	unsigned long long cycles = 0;
+	std::vector<std::string> lines;
+};
+
+static bool IsAbsolutePath(const std::string& path) {
+	if (path.empty()) return false;
+	if (path[0] == '/' || path[0] == '\\') return true;
+	return path.size() > 1 && path[1] == ':';
+}
+
+static bool ParseNumber(std::string_view text, uint base, unsigned long long& value) {
+	if (base == 16 && text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) text.remove_prefix(2);
+	if (text.empty()) return false;
+	value = 0;
+	for (char c : text) {
+		uint digit;
+		if (c >= '0' && c <= '9') digit = c - '0';
+		else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+		else return false;
+		if (digit >= base) return false;
+		value = value * base + digit;
+	}
+	return true;
+}
+
+/*****************************************/
+/*										 */
+/*				PARSING					 */
+/*                                       */
+/*****************************************/
+static bool ParseLine(const lex_token* tokens, uint count, scenario& current) {
+	unsigned long long value;
+	std::string_view command = tokens[0].text;
+	if (NoCaseEquals(command, "rom") && count >= 2) {
+		current.rom_paths.clear();
+		current.optimize = current.outline = false;
+		for (uint t = 1; t < count; t++) {
+			if (tokens[t].text == "-O") current.optimize = true;
+			else if (tokens[t].text == "-Os") current.optimize = current.outline = true;
+			else current.rom_paths.push_back(std::string(tokens[t].text));
+		}
+		return !current.rom_paths.empty();
+	}
+	if ((NoCaseEquals(command, "seed") || NoCaseEquals(command, "cycles") || NoCaseEquals(command, "frames")) && count == 2) {
+		if (!ParseNumber(tokens[1].text, 10, value) || value > 0xFFFFFFFF) return false;
+		if (NoCaseEquals(command, "seed")) current.seed = (uint)value;
+		else if (NoCaseEquals(command, "cycles")) current.cycles = (uint)value;
+		else current.frames = (uint)value;
+		return true;
+	}
+	if (!NoCaseEquals(command, "at") || count < 3) return false;
+
+	scenario_event event = {};
+	if (!ParseNumber(tokens[1].text, 10, value) || value > 0xFFFFFFFF) return false;
+	event.frame = (uint)value;
+	std::string_view action = tokens[2].text;
+	if (NoCaseEquals(action, "print") && count == 3) event.kind = SCENARIO_PRINT;
+	else if (NoCaseEquals(action, "expect") && count == 4) {
+		if (!ParseNumber(tokens[3].text, 16, event.hash)) return false;
+		event.kind = SCENARIO_EXPECT;
+	}
+	else if ((NoCaseEquals(action, "press") || NoCaseEquals(action, "release")) && count == 4) {
+		if (!ParseNumber(tokens[3].text, 16, value) || value >= VM_KEY_COUNT) return false;
+		event.key = (uint)value;
+		event.kind = NoCaseEquals(action, "press") ? SCENARIO_KEY_PRESS : SCENARIO_KEY_RELEASE;
+	}
+	else return false;
+	current.events.push_back(event);
+	return true;
+}
+
+static void FinishScenario(scenario& current, std::vector<scenario>& scenarios) {
+	//Events on the same frame keep their file order
+	std::stable_sort(current.events.begin(), current.events.end(),
+					 [](const scenario_event& a, const scenario_event& b) { return a.frame < b.frame; });
+	if (current.frames == 0 && !current.events.empty()) current.frames = current.events.back().frame;
+	scenarios.push_back(current);
+}
+
+bool SCENARIO_ReadFile(std::string path, std::vector<scenario>& scenarios) {
+	lexed_file file;
+	if (!LEX_ReadFile(path, file.source)) {
+		printf("Scenario file \"%s\" could not be opened/found.\n", path.c_str());
+		return false;
+	}
+	LEX_Tokenize(file);
+	size_t dir_end = path.find_last_of("\\/");
+	std::string scenario_dir = (dir_end != path.npos) ? path.substr(0, dir_end + 1) : "";
+
+	bool valid = true;
+	size_t first_scenario = scenarios.size();
+	scenario defaults;
+	defaults.file = path;
+	defaults.line = 0;
+	scenario current = defaults;
+	bool named = false;
+	for (const lex_line& line : file.lines) {
+		const lex_token* tokens = &file.tokens[line.first];
+		if (NoCaseEquals(tokens[0].text, "scenario")) {
+			if (named) FinishScenario(current, scenarios);
+			else defaults = current;
+			current = defaults;
+			current.line = line.number;
+			for (uint t = 1; t < line.count; t++) {
+				if (t > 1) current.name += ' ';
+				current.name += tokens[t].text;
+			}
+			named = true;
+			continue;
+		}
+		uint first_event = (uint)current.events.size();
+		if (!ParseLine(tokens, line.count, current)) {
+			printf("%s(%i): could not understand \"%.*s\".\n", path.c_str(), line.number, VIEW_ARG(tokens[0].text));
+			valid = false;
+			continue;
+		}
+		if (current.events.size() > first_event) current.events.back().line = line.number;
+		if (NoCaseEquals(tokens[0].text, "rom")) {
+			for (std::string& rom_path : current.rom_paths) {
+				if (!IsAbsolutePath(rom_path)) rom_path = scenario_dir + rom_path;
+			}
+		}
+	}
+	if (!named) current.line = 1;
+	FinishScenario(current, scenarios);
+
+	for (size_t s = first_scenario; s < scenarios.size(); s++) {
+		if (scenarios[s].rom_paths.empty()) {
+			printf("%s(%i): scenario has no rom.\n", path.c_str(), scenarios[s].line);
+			valid = false;
+		}
+	}
+	return valid;
+}
+
+/*****************************************/
+/*										 */
+/*				RUNNING					 */
+/*                                       */
+/*****************************************/
+/*
+	ROMs load in parallel, and several can share a source, so nothing is
+	written to disk: each source is assembled to an object in memory, and
+	the objects are linked in memory too.
+*/
+static std::unique_ptr<asm_context> LinkRom(const rom_image& rom) {
+	std::vector<object_file> objects(rom.paths.size());
+	for (uint i = 0; i < rom.paths.size(); i++) {
+		std::unique_ptr<asm_context> ctx(new asm_context());
+		ctx->options.in_memory = true;
+		ctx->options.relocatable = true;
+		ctx->options.optimize = rom.optimize;
+		ASM_Begin(*ctx, rom.paths[i]);
+		if (!ctx->error_list.empty() || !LINK_MakeObject(*ctx, objects[i])) return ctx;
+	}
+	std::unique_ptr<asm_context> ctx(new asm_context());
+	ctx->options.in_memory = true;
+	LINK_LinkObjects(*ctx, objects);
+	if (ctx->error_list.empty()) ASM_WriteToFile(*ctx);
+	return ctx;
+}
+
+static void LoadRom(rom_image& rom) {
+	size_t ext = rom.path.find_last_of('.');
+	if (rom.paths.size() == 1 && ext != rom.path.npos && rom.path.compare(ext, std::string::npos, ROM_EXTENSION) == 0) {
+		std::string buffer;
+		if (!LEX_ReadFile(rom.path, buffer) || buffer.size() > MAX_ROMSIZE) return;
+		rom.data.assign(buffer.begin(), buffer.end());
+		rom.loaded = true;
+		return;
+	}
+	std::unique_ptr<asm_context> ctx;
+	if (rom.paths.size() > 1) ctx = LinkRom(rom);
+	else {
+		ctx.reset(new asm_context());
+		ctx->options.in_memory = true;
+		ctx->options.optimize = rom.optimize;
+		ctx->options.outline = rom.outline;
+		ASM_Begin(*ctx, rom.path);
+	}
+	if (!ctx->error_list.empty()) {
+		rom.failed = std::move(ctx);
+		return;
+	}
+	rom.data.assign(ctx->rom_output, ctx->rom_output + ctx->rom_index);
+	rom.labels = PROFILE_Labels(ctx->symbols);
+	rom.loaded = true;
+}
+
+static void AddLine(scenario_result& result, const char* fmt, ...) {
+	char buffer[256];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(buffer, sizeof(buffer), fmt, args);
+	va_end(args);
+	result.lines.push_back(buffer);
+}
+
+static void RunScenario(const scenario& test, const rom_image& rom, scenario_result& result, vm_profile* profile) {
+	chip8_vm vm;
+	VM_Reset(vm, rom.data.data(), (uint)rom.data.size(), test.seed);
+	vm.profile = profile;
+	uint next = 0;
+	for (;;) {
+		for (; next < test.events.size() && test.events[next].frame == vm.frames; next++) {
+			const scenario_event& event = test.events[next];
+			switch (event.kind) {
+			case SCENARIO_KEY_PRESS:   VM_SetKey(vm, event.key, true); break;
+			case SCENARIO_KEY_RELEASE: VM_SetKey(vm, event.key, false); break;
+			case SCENARIO_PRINT:
+				AddLine(result, "Line %i: frame %i screen hash %016llX", event.line, vm.frames, VM_ScreenHash(vm));
+				break;
+			case SCENARIO_EXPECT: {
+				unsigned long long hash = VM_ScreenHash(vm);
+				if (hash != event.hash) {
+					AddLine(result, "Line %i: frame %i screen hash is %016llX, expected %016llX",
+							event.line, vm.frames, hash, event.hash);
+					result.passed = false;
+				}
+				break;
+			}
+			}
+		}
+		if (vm.frames >= test.frames || vm.status > VM_WAITING_KEY) break;
+		VM_RunFrame(vm, test.cycles);
+	}
+	if (vm.status > VM_WAITING_KEY) {
+		AddLine(result, "Stopped at frame %i, pc 0x%03X: %s", vm.frames, vm.pc, VM_StatusName(vm.status));
+		result.passed = false;
+	}
+	if (profile) {
+		profile->runs++;
+		profile->frames += vm.frames;
+	}
+	result.status = vm.status;
+	result.frames = vm.frames;
+	result.cycles = vm.cycles;
+}
+
+static std::string ProfilePath(const std::string& rom_path) {
+	size_t ext = rom_path.find_last_of('.');
+	size_t dir_end = rom_path.find_last_of("\\/");
+	if (ext == rom_path.npos || (dir_end != rom_path.npos && ext < dir_end)) ext = rom_path.size();
+	return rom_path.substr(0, ext) + PROFILE_EXTENSION;
+}
+
+int SCENARIO_RunAll(const std::vector<std::string>& paths, uint thread_count, bool profile) {
+	std::vector<scenario> scenarios;
+	bool valid = true;
+	for (const auto& path : paths) valid = SCENARIO_ReadFile(path, scenarios) && valid;
+	if (!valid) return 1;
+
+	//Each ROM is loaded (or assembled) once, however many scenarios run it
+	std::map<std::string, uint> rom_index;
+	std::vector<rom_image> roms;
+	std::vector<uint> scenario_rom(scenarios.size());
+	for (uint s = 0; s < scenarios.size(); s++) {
+		const scenario& test = scenarios[s];
+		std::string key = test.outline ? "-Os" : test.optimize ? "-O" : "";
+		for (const std::string& path : test.rom_paths) key += "\n" + path;
+		auto found = rom_index.emplace(key, (uint)roms.size());
+		if (found.second) {
+			roms.emplace_back();
+			roms.back().path = test.rom_paths[0];
+			roms.back().paths = test.rom_paths;
+			roms.back().optimize = test.optimize;
+			roms.back().outline = test.outline;
+		}
+		scenario_rom[s] = found.first->second;
+	}
+	stopwatch timer = STATS_Start();
+	RunJobs(roms.size(), thread_count, [&](uint i) { LoadRom(roms[i]); });
+	double load_seconds = STATS_Seconds(timer);
+	for (auto& rom : roms) {
+		if (rom.loaded) continue;
+		if (rom.failed) PrintAllErrors(*rom.failed);
+		else printf("ROM \"%s\" could not be opened/found, or is over %i bytes.\n", rom.path.c_str(), MAX_ROMSIZE);
+		valid = false;
+	}
+	if (!valid) return 1;
+
+	std::vector<std::mutex> profile_locks(roms.size());
+	if (profile) {
+		for (auto& rom : roms) {
+			rom.profile.reset(new vm_profile());
+			PROFILE_Begin(*rom.profile);
+		}
+	}
+
+	std::vector<scenario_result> results(scenarios.size());
+	timer = STATS_Start();
+	RunJobs(scenarios.size(), thread_count, [&](uint i) {
+		rom_image& rom = roms[scenario_rom[i]];
+		if (!profile) {
+			RunScenario(scenarios[i], rom, results[i], nullptr);
+			return;
+		}
+		//Each run gets its own profile, folded into the ROM's once it is done
+		std::unique_ptr<vm_profile> run_profile(new vm_profile());
+		PROFILE_Begin(*run_profile);
+		RunScenario(scenarios[i], rom, results[i], run_profile.get());
+		std::lock_guard<std::mutex> lock(profile_locks[scenario_rom[i]]);
+		PROFILE_Merge(*rom.profile, *run_profile);
+	});
+	double run_seconds = STATS_Seconds(timer);
+
+	uint failed = 0;
+	unsigned long long cycles = 0;
+	for (uint s = 0; s < scenarios.size(); s++) {
+		const scenario_result& result = results[s];
+		cycles += result.cycles;
+		if (!result.passed) failed++;
+		if (result.passed && result.lines.empty()) continue;
+		printf("%s %s(%i)%s%s: %i frames, %llu instructions\n", result.passed ? "PASS" : "FAIL",
+			   scenarios[s].file.c_str(), scenarios[s].line,
+			   scenarios[s].name.empty() ? "" : " ", scenarios[s].name.c_str(), result.frames, result.cycles);
+		for (const auto& line : result.lines) printf("   %s\n", line.c_str());
+	}
+	printf("\nPassed %i/%i scenarios (%i ROMs loaded in %.3f ms).\n",
+		   (uint)(scenarios.size() - failed), (uint)scenarios.size(), (uint)roms.size(), load_seconds * 1000);
+	if (run_seconds > 0) {
+		printf("Ran in %.3f ms: %.0f scenarios/s, %.1f million instructions/s.\n",
+			   run_seconds * 1000, scenarios.size() / run_seconds, cycles / run_seconds / 1e6);
+	}
+	for (const auto& rom : roms) {
+		if (!rom.profile) continue;
+		PROFILE_Report(*rom.profile, rom.labels, rom.path);
+		std::string path = ProfilePath(rom.path);
+		if (PROFILE_WriteCollapsed(*rom.profile, rom.labels, path)) printf("Wrote call stacks to \"%s\".\n", path.c_str());
+		else printf("Call stacks could not be written to \"%s\".\n", path.c_str());
+	}
+	return (failed == 0) ? 0 : 1;
+}
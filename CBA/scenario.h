@@ -0,0 +1,60 @@
+#ifndef CBA_SCENARIO_H
+#define CBA_SCENARIO_H
+#pragma once
+#include "stdafx.h"
+#include "vm.h"
+
+#define SCENARIO_KEY_PRESS   0x00
+#define SCENARIO_KEY_RELEASE 0x01
+#define SCENARIO_EXPECT      0x02
+#define SCENARIO_PRINT       0x03
+
+// Something that happens once a scenario has run for frame frames
+struct scenario_event {
+	uint frame;
+	uint kind;
+	uint key;
+	unsigned long long hash;	/* SCENARIO_EXPECT only */
+	uint line;
+};
+
+/*
+	One run of a ROM. A scenario file is a list of commands:
+
+		rom <path> [-O|-Os]        A .c8 image, or a source that is assembled first
+		rom <path> <path> ...      Sources assembled as objects (-c) and linked
+		seed <n>                   Seeds rand
+		cycles <n>                 Instructions per frame
+		frames <n>                 Frames to run (default: up to the last event)
+		at <frame> press <key>
+		at <frame> release <key>
+		at <frame> expect <hash>   Fails unless the screen hash matches
+		at <frame> print           Prints the screen hash
+		scenario <name>            Starts another scenario in the same file
+
+	Commands before the first scenario line are defaults for every scenario
+	in the file. Paths are relative to the scenario file.
+*/
+struct scenario {
+	std::string file;
+	uint line;
+	std::string name;
+	std::vector<std::string> rom_paths;
+	bool optimize = false;	/* -O, for sources */
+	bool outline = false;	/* -Os */
+	uint seed = 0;
+	uint cycles = VM_CYCLES_PER_FRAME;
+	uint frames = 0;
+	std::vector<scenario_event> events;
+};
+
+// Appends every scenario in a file. Prints any problems and returns false.
+bool SCENARIO_ReadFile(std::string path, std::vector<scenario>& scenarios);
+
+// Loads each ROM once, runs every scenario across thread_count threads and
+// prints the results in order. With profile, also prints each ROM's hottest
+// routines and writes its call stacks next to it. Returns 0 if every
+// scenario passed.
+int SCENARIO_RunAll(const std::vector<std::string>& paths, uint thread_count, bool profile);
+
+#endif
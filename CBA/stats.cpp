@@ -0,0 +1,196 @@
+#include "stats.h"
+#include "context.h"
+#include <stdlib.h>
+#include <new>
+#include <fstream>
+#include <iomanip>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#include <malloc.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/*
+	Every allocation in the process, in every form of new and delete, goes
+	through here so --stats can report allocation counts. Nothing is counted
+	until STATS_CountAllocations, so other runs only pay for a branch. The
+	counters are per thread, so each ROM in a batch gets its own figures.
+*/
+static bool count_allocations = false;
+static thread_local unsigned long long allocation_count = 0;
+static thread_local unsigned long long allocation_bytes = 0;
+
+static void* Allocate(size_t size) noexcept {
+	if (count_allocations) {
+		allocation_count++;
+		allocation_bytes += size;
+	}
+	return malloc((size > 0) ? size : 1);
+}
+
+static void* AllocateAligned(size_t size, std::align_val_t align) noexcept {
+	if (count_allocations) {
+		allocation_count++;
+		allocation_bytes += size;
+	}
+	size_t alignment = (size_t)align;
+#ifdef _WIN32
+	return _aligned_malloc((size > 0) ? size : 1, alignment);
+#else
+	//aligned_alloc wants a whole number of alignments
+	return aligned_alloc(alignment, ((size > 0 ? size : 1) + alignment - 1) & ~(alignment - 1));
+#endif
+}
+
+static void FreeAligned(void* ptr) noexcept {
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+static void* AllocateOrThrow(void* result) {
+	if (result == nullptr) throw std::bad_alloc();
+	return result;
+}
+
+void* operator new(size_t size) { return AllocateOrThrow(Allocate(size)); }
+void* operator new[](size_t size) { return AllocateOrThrow(Allocate(size)); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return Allocate(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return Allocate(size); }
+void* operator new(size_t size, std::align_val_t align) { return AllocateOrThrow(AllocateAligned(size, align)); }
+void* operator new[](size_t size, std::align_val_t align) { return AllocateOrThrow(AllocateAligned(size, align)); }
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return AllocateAligned(size, align); }
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return AllocateAligned(size, align); }
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { FreeAligned(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { FreeAligned(ptr); }
+
+void STATS_CountAllocations() {
+	count_allocations = true;
+}
+
+void STATS_ThreadAllocations(unsigned long long* count, unsigned long long* bytes) {
+	*count = allocation_count;
+	*bytes = allocation_bytes;
+}
+
+unsigned long long STATS_PeakMemory() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	return (unsigned long long)usage.ru_maxrss * 1024;
+#endif
+}
+
+stopwatch STATS_Start() {
+	return std::chrono::steady_clock::now();
+}
+
+double STATS_Seconds(stopwatch start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double PerSecond(uint count, double seconds) {
+	return (seconds > 0) ? count / seconds : 0;
+}
+
+void STATS_Print(const asm_context& ctx) {
+	const asm_stats& stats = ctx.stats;
+	double lex_and_assemble = stats.lex_seconds + stats.first_pass_seconds;
+	printf("\nStatistics for \"%s\":\n", ctx.output_name.c_str());
+	printf("  Read:         %10.3f ms\n", stats.read_seconds * 1000);
+	printf("  Lex:          %10.3f ms\n", stats.lex_seconds * 1000);
+	printf("  First pass:   %10.3f ms\n", stats.first_pass_seconds * 1000);
+	printf("  Second pass:  %10.3f ms\n", stats.second_pass_seconds * 1000);
+	printf("  Write:        %10.3f ms\n", stats.write_seconds * 1000);
+	printf("  Errors:       %10.3f ms\n", stats.error_seconds * 1000);
+	printf("  Total:        %10.3f ms%s\n", stats.total_seconds * 1000, stats.build_cached ? " (build cache hit)" : "");
+	printf("  Lines:        %10u (%.0f/s)\n", stats.lines, PerSecond(stats.lines, lex_and_assemble));
+	printf("  Tokens:       %10u (%.0f/s)\n", stats.tokens, PerSecond(stats.tokens, lex_and_assemble));
+	printf("  Symbols:      %10u\n", stats.symbols);
+	printf("  Fixups:       %10u\n", stats.fixups);
+	printf("  ROM bytes:    %10u\n", stats.bytes);
+	printf("  Allocations:  %10llu (%llu bytes)\n", stats.allocations, stats.allocated_bytes);
+	printf("  Peak memory:  %10llu KB (process)\n", STATS_PeakMemory() / 1024);
+	for (const auto& file : stats.files) {
+		printf("    %10.3f ms  %6u lines  %s%s\n", file.seconds * 1000, file.lines,
+			   file.path.c_str(), file.cached ? " (cached)" : "");
+	}
+}
+
+static void WriteJsonString(std::ofstream& out, const std::string& str) {
+	out << '"';
+	for (const char& c : str) {
+		if (c == '"' || c == '\\') out << '\\' << c;
+		else if ((byte)c >= 0x20) out << c;
+		else {
+			char escape[8];
+			snprintf(escape, sizeof(escape), "\\u%04X", (uint)(byte)c);
+			out << escape;
+		}
+	}
+	out << '"';
+}
+
+bool STATS_WriteJson(std::string path, const std::vector<const asm_context*>& contexts) {
+	std::ofstream out(path, std::ofstream::trunc);
+	if (!out.is_open()) {
+		printf("Could not create/open stats file: \"%s\"\n", path.c_str());
+		return false;
+	}
+	out << std::fixed << std::setprecision(9);
+	out << "{\n  \"version\": \"" << CBA_VERSION << "\",\n";
+	out << "  \"peak_memory\": " << STATS_PeakMemory() << ",\n";
+	out << "  \"roms\": [";
+	for (uint i = 0; i < contexts.size(); i++) {
+		const asm_context& ctx = *contexts[i];
+		const asm_stats& stats = ctx.stats;
+		out << ((i == 0) ? "\n" : ",\n") << "    {\n      \"source\": ";
+		WriteJsonString(out, ctx.source_files.empty() ? std::string() : ctx.source_files[0]);
+		out << ",\n      \"errors\": " << ctx.error_list.size() << ",\n";
+		out << "      \"build_cached\": " << (stats.build_cached ? "true" : "false") << ",\n";
+		out << "      \"seconds\": { \"read\": " << stats.read_seconds
+			<< ", \"lex\": " << stats.lex_seconds
+			<< ", \"first_pass\": " << stats.first_pass_seconds
+			<< ", \"second_pass\": " << stats.second_pass_seconds
+			<< ", \"write\": " << stats.write_seconds
+			<< ", \"errors\": " << stats.error_seconds
+			<< ", \"total\": " << stats.total_seconds << " },\n";
+		out << "      \"lines\": " << stats.lines << ",\n";
+		out << "      \"tokens\": " << stats.tokens << ",\n";
+		out << "      \"symbols\": " << stats.symbols << ",\n";
+		out << "      \"fixups\": " << stats.fixups << ",\n";
+		out << "      \"bytes\": " << stats.bytes << ",\n";
+		out << "      \"allocations\": " << stats.allocations << ",\n";
+		out << "      \"allocated_bytes\": " << stats.allocated_bytes << ",\n";
+		out << "      \"files\": [";
+		for (uint f = 0; f < stats.files.size(); f++) {
+			const file_stats& file = stats.files[f];
+			out << ((f == 0) ? "\n" : ",\n") << "        { \"path\": ";
+			WriteJsonString(out, file.path);
+			out << ", \"seconds\": " << file.seconds << ", \"lines\": " << file.lines
+				<< ", \"tokens\": " << file.tokens << ", \"cached\": " << (file.cached ? "true" : "false") << " }";
+		}
+		out << "\n      ]\n    }";
+	}
+	out << "\n  ]\n}\n";
+	return true;
+}
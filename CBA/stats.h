@@ -0,0 +1,55 @@
+#ifndef CBA_STATS_H
+#define CBA_STATS_H
+#pragma once
+#include "stdafx.h"
+#include <chrono>
+
+struct file_stats {
+	std::string path;
+	double seconds;		/* Load and first pass, including nested includes */
+	uint lines;
+	uint tokens;
+	bool cached;
+};
+
+/*
+	Timings and counters for one ROM. Allocation counts are taken from the
+	thread that assembled the ROM, so they stay accurate in batch mode.
+*/
+struct asm_stats {
+	double read_seconds = 0;
+	double lex_seconds = 0;
+	double first_pass_seconds = 0;
+	double second_pass_seconds = 0;
+	double write_seconds = 0;
+	double error_seconds = 0;
+	double total_seconds = 0;
+	bool build_cached = false;	/* Restored from the build cache, nothing was assembled */
+
+	uint lines = 0;
+	uint tokens = 0;
+	uint symbols = 0;
+	uint fixups = 0;
+	uint bytes = 0;
+	unsigned long long allocations = 0;
+	unsigned long long allocated_bytes = 0;
+
+	std::vector<file_stats> files;
+};
+
+struct asm_context;
+
+typedef std::chrono::steady_clock::time_point stopwatch;
+stopwatch STATS_Start();
+double STATS_Seconds(stopwatch start);
+
+// Starts counting allocations for STATS_ThreadAllocations. Call it before
+// starting any threads.
+void STATS_CountAllocations();
+void STATS_ThreadAllocations(unsigned long long* count, unsigned long long* bytes);
+unsigned long long STATS_PeakMemory();
+
+void STATS_Print(const asm_context& ctx);
+bool STATS_WriteJson(std::string path, const std::vector<const asm_context*>& contexts);
+
+#endif
@@ -15,10 +15,14 @@ typedef unsigned short word;
 #define CHIP8_MEMSIZE 4096
 #define CHIP8_MEMSTART 512
 #define MAX_ROMSIZE (CHIP8_MEMSIZE - CHIP8_MEMSTART)
+#define ROM_STAGING_SIZE (MAX_ROMSIZE * 2)	/* What -O can assemble before shrinking */
 #define INSTRUCTION_SIZE 2
 #define LITERAL_SIZE 1
+#define SWITCH_MAX_CASES 128	/* add v0 v0 wraps past this */
 
 #define ROM_EXTENSION ".c8"
+#define OBJECT_EXTENSION ".o8"
+#define DEPFILE_EXTENSION ".d"
 
 #define COMMENT_SYM '#'
 
@@ -0,0 +1,76 @@
+#include "symbol.h"
+#include <algorithm>
+#include <new>
+
+#define ARENA_BLOCK_SIZE 16384
+#define MIN_SLOT_COUNT 64
+
+static inline char FoldCase(char c) {
+	return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+static uint HashName(std::string_view name) {
+	uint hash = 2166136261u;
+	for (const char& c : name)
+		hash = (hash ^ (byte)FoldCase(c)) * 16777619u;
+	return hash;
+}
+
+static bool NamesMatch(std::string_view a, std::string_view b) {
+	if (a.size() != b.size()) return false;
+	for (size_t i = 0; i < a.size(); i++)
+		if (FoldCase(a[i]) != FoldCase(b[i])) return false;
+	return true;
+}
+
+static void* ArenaAlloc(symbol_table& table, size_t size) {
+	size = (size + alignof(symbol) - 1) & ~(alignof(symbol) - 1);
+	if (table.block_used + size > table.block_size) {
+		size_t block_size = (size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE;
+		table.blocks.emplace_back(new char[block_size]);
+		table.block_used = 0;
+		table.block_size = block_size;
+	}
+	void* result = table.blocks.back().get() + table.block_used;
+	table.block_used += size;
+	return result;
+}
+
+static symbol** FindSlot(const std::vector<symbol*>& slots, std::string_view name, uint hash) {
+	uint mask = slots.size() - 1;
+	for (uint i = hash & mask;; i = (i + 1) & mask) {
+		symbol* const* slot = &slots[i];
+		if (*slot == nullptr || ((*slot)->hash == hash && NamesMatch((*slot)->name, name)))
+			return const_cast<symbol**>(slot);
+	}
+}
+
+static void Grow(symbol_table& table) {
+	std::vector<symbol*> slots((table.slots.empty()) ? MIN_SLOT_COUNT : table.slots.size() * 2, nullptr);
+	for (symbol* sym : table.records)
+		*FindSlot(slots, sym->name, sym->hash) = sym;
+	table.slots.swap(slots);
+}
+
+symbol* SYM_Find(const symbol_table& table, std::string_view name) {
+	if (table.slots.empty()) return nullptr;
+	return *FindSlot(table.slots, name, HashName(name));
+}
+
+// Returns the existing symbol for name, or a new SYMBOL_NONE record
+symbol* SYM_Intern(symbol_table& table, std::string_view name) {
+	if (table.records.size() * 2 >= table.slots.size()) Grow(table);
+	uint hash = HashName(name);
+	symbol** slot = FindSlot(table.slots, name, hash);
+	if (*slot != nullptr) return *slot;
+
+	char* name_copy = (char*)ArenaAlloc(table, name.size());
+	std::copy(name.begin(), name.end(), name_copy);
+	symbol* sym = new (ArenaAlloc(table, sizeof(symbol))) symbol();
+	sym->name = std::string_view(name_copy, name.size());
+	sym->hash = hash;
+	sym->kind = SYMBOL_NONE;
+	*slot = sym;
+	table.records.push_back(sym);
+	return sym;
+}
@@ -0,0 +1,48 @@
+#ifndef CBA_SYMBOL_H
+#define CBA_SYMBOL_H
+#pragma once
+#include "stdafx.h"
+#include <string_view>
+#include <memory>
+
+#define SYMBOL_NONE  0x00
+#define SYMBOL_LABEL 0x01
+#define SYMBOL_ALIAS 0x02
+
+/*
+	A label or alias. value/type/bitcount are the operand the symbol stands
+	for, so a defined label or resolved alias turns straight into a token.
+	An alias of a label that has not been defined yet points at that label
+	through target instead, and is resolved on first use after it is.
+*/
+struct symbol {
+	std::string_view name;
+	uint hash;
+	uint kind;
+	uint value;
+	uint type;
+	uint bitcount;
+	symbol* target;
+};
+
+/*
+	Case-insensitive interned symbols. Records and their names are carved out
+	of large arena blocks and never move, so symbol pointers stay valid for the
+	life of the table. Lookups are a single open-addressed hash probe sequence.
+*/
+struct symbol_table {
+	std::vector<std::unique_ptr<char[]>> blocks;
+	size_t block_used = 0;
+	size_t block_size = 0;
+
+	std::vector<symbol*> slots;
+	std::vector<symbol*> records;
+};
+
+// Labels the assembler makes up (.switch tables) hold '@', which source labels can't
+inline bool SYM_Generated(const symbol* sym) { return sym->name.find('@') != std::string_view::npos; }
+
+symbol* SYM_Find(const symbol_table& table, std::string_view name);
+symbol* SYM_Intern(symbol_table& table, std::string_view name);
+
+#endif
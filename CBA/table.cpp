@@ -0,0 +1,207 @@
+#include "table.h"
+#include "lexer.h"
+#include <cmath>
+#include <ctype.h>
+#include <stdlib.h>
+
+#define TABLE_PI 3.14159265358979323846
+
+enum ExprValues {
+	EXPR_PUSH,
+	EXPR_INDEX,
+	EXPR_COUNT,
+	EXPR_ADD,
+	EXPR_SUB,
+	EXPR_MUL,
+	EXPR_DIV,
+	EXPR_MOD,
+	EXPR_NEG,
+	EXPR_FUNCTION	/* Plus a TableFunctionValues */
+};
+
+#define X(a, b) { #a, b },
+static const struct { const char* name; uint args; } functions[TABLE_FN_COUNT] = {
+	TABLE_FUNCTIONS
+};
+#undef X
+
+struct table_parser {
+	asm_context& ctx;
+	std::string_view text;
+	size_t at;
+	table_lookup lookup;
+	table_program& program;
+	std::string& error;
+};
+
+static bool ParseSum(table_parser& p);
+
+static inline bool IsNameChar(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Skips whitespace up to the next character, or '\0' at the end
+static char Peek(table_parser& p) {
+	while (p.at < p.text.size() && (p.text[p.at] == ' ' || p.text[p.at] == '\t' || p.text[p.at] == '\r')) p.at++;
+	return (p.at < p.text.size()) ? p.text[p.at] : '\0';
+}
+
+static bool Fail(table_parser& p, const char* what) {
+	std::string_view rest = p.text.substr(std::min(p.at, p.text.size()));
+	p.error = what;
+	if (rest.empty()) p.error += " at the end";
+	else p.error += " at \"" + std::string(rest) + "\"";
+	return false;
+}
+
+static bool ParseNumber(table_parser& p) {
+	std::string_view rest = p.text.substr(p.at);
+	size_t length = 0;
+	double value = 0;
+	bool hex = rest[0] == '$' || (rest.size() >= 2 && rest[0] == '0' && (rest[1] == 'x' || rest[1] == 'X'));
+	if (hex) {
+		size_t digits = (rest[0] == '$') ? 1 : 2;
+		length = digits;
+		while (length < rest.size() && isxdigit((byte)rest[length])) length++;
+		if (length == digits) return Fail(p, "Expected hex digits");
+		value = (double)strtoul(std::string(rest.substr(digits, length - digits)).c_str(), nullptr, 16);
+	}
+	else {
+		while (length < rest.size() && ((rest[length] >= '0' && rest[length] <= '9') || rest[length] == '.')) length++;
+		std::string number(rest.substr(0, length));
+		char* end;
+		value = strtod(number.c_str(), &end);
+		if (*end != '\0') return Fail(p, "Malformed number");
+	}
+	if (p.at + length < p.text.size() && IsNameChar(p.text[p.at + length])) return Fail(p, "Malformed number");
+	p.at += length;
+	p.program.ops.push_back({ EXPR_PUSH, value });
+	return true;
+}
+
+static bool ParseName(table_parser& p) {
+	size_t start = p.at;
+	while (p.at < p.text.size() && IsNameChar(p.text[p.at])) p.at++;
+	std::string_view name = p.text.substr(start, p.at - start);
+	for (uint f = 0; f < TABLE_FN_COUNT; f++) {
+		if (!NoCaseEquals(name, functions[f].name)) continue;
+		if (Peek(p) != '(') return Fail(p, "Expected ( after a function");
+		p.at++;
+		for (uint a = 0; a < functions[f].args; a++) {
+			if (a > 0) {
+				if (Peek(p) != ',') return Fail(p, "Expected another argument");
+				p.at++;
+			}
+			if (!ParseSum(p)) return false;
+		}
+		if (Peek(p) != ')') return Fail(p, "Expected )");
+		p.at++;
+		p.program.ops.push_back({ EXPR_FUNCTION + f, 0 });
+		return true;
+	}
+	if (NoCaseEquals(name, "i")) p.program.ops.push_back({ EXPR_INDEX, 0 });
+	else if (NoCaseEquals(name, "n")) p.program.ops.push_back({ EXPR_COUNT, 0 });
+	else if (NoCaseEquals(name, "pi")) p.program.ops.push_back({ EXPR_PUSH, TABLE_PI });
+	else {
+		double value;
+		if (!p.lookup(p.ctx, name, &value)) {
+			p.at = start;
+			return Fail(p, "Unknown name");
+		}
+		p.program.ops.push_back({ EXPR_PUSH, value });
+	}
+	return true;
+}
+
+static bool ParseUnary(table_parser& p) {
+	char c = Peek(p);
+	if (c == '-' || c == '+') {
+		p.at++;
+		if (!ParseUnary(p)) return false;
+		if (c == '-') p.program.ops.push_back({ EXPR_NEG, 0 });
+		return true;
+	}
+	if (c == '(') {
+		p.at++;
+		if (!ParseSum(p)) return false;
+		if (Peek(p) != ')') return Fail(p, "Expected )");
+		p.at++;
+		return true;
+	}
+	if ((c >= '0' && c <= '9') || c == '.' || c == '$') return ParseNumber(p);
+	if (IsNameChar(c)) return ParseName(p);
+	return Fail(p, "Expected a value");
+}
+
+static bool ParseProduct(table_parser& p) {
+	if (!ParseUnary(p)) return false;
+	for (char c = Peek(p); c == '*' || c == '/' || c == '%'; c = Peek(p)) {
+		p.at++;
+		if (!ParseUnary(p)) return false;
+		p.program.ops.push_back({ (uint)((c == '*') ? EXPR_MUL : (c == '/') ? EXPR_DIV : EXPR_MOD), 0 });
+	}
+	return true;
+}
+
+static bool ParseSum(table_parser& p) {
+	if (!ParseProduct(p)) return false;
+	for (char c = Peek(p); c == '+' || c == '-'; c = Peek(p)) {
+		p.at++;
+		if (!ParseProduct(p)) return false;
+		p.program.ops.push_back({ (uint)((c == '+') ? EXPR_ADD : EXPR_SUB), 0 });
+	}
+	return true;
+}
+
+bool TABLE_Compile(asm_context& ctx, std::string_view text, table_lookup lookup, table_program& program, std::string& error) {
+	program.ops.clear();
+	table_parser p = { ctx, text, 0, lookup, program, error };
+	if (!ParseSum(p)) return false;
+	if (Peek(p) != '\0') return Fail(p, "Unexpected text");
+	return true;
+}
+
+double TABLE_Evaluate(const table_program& program, double index, double count) {
+	std::vector<double> stack;
+	stack.reserve(program.ops.size());
+	for (const table_op& op : program.ops) {
+		switch (op.kind) {
+		case EXPR_PUSH:  stack.push_back(op.value); continue;
+		case EXPR_INDEX: stack.push_back(index); continue;
+		case EXPR_COUNT: stack.push_back(count); continue;
+		}
+		double& a = stack.back();
+		switch (op.kind) {
+		case EXPR_NEG: a = -a; continue;
+		case EXPR_FUNCTION + TABLE_FN_sin:   a = sin(a); continue;
+		case EXPR_FUNCTION + TABLE_FN_cos:   a = cos(a); continue;
+		case EXPR_FUNCTION + TABLE_FN_sqrt:  a = sqrt(a); continue;
+		case EXPR_FUNCTION + TABLE_FN_abs:   a = fabs(a); continue;
+		case EXPR_FUNCTION + TABLE_FN_floor: a = floor(a); continue;
+		case EXPR_FUNCTION + TABLE_FN_ceil:  a = ceil(a); continue;
+		case EXPR_FUNCTION + TABLE_FN_round: a = floor(a + 0.5); continue;
+		}
+		double b = stack.back();
+		stack.pop_back();
+		double& left = stack.back();
+		switch (op.kind) {
+		case EXPR_ADD: left += b; break;
+		case EXPR_SUB: left -= b; break;
+		case EXPR_MUL: left *= b; break;
+		case EXPR_DIV: left = (b == 0) ? NAN : left / b; break;
+		case EXPR_MOD: left = (b == 0) ? NAN : fmod(left, b); break;
+		case EXPR_FUNCTION + TABLE_FN_min: left = fmin(left, b); break;
+		case EXPR_FUNCTION + TABLE_FN_max: left = fmax(left, b); break;
+		}
+	}
+	return stack.back();
+}
+
+bool TABLE_ToByte(double value, uint mode, byte* result) {
+	value = floor(value + 0.5);
+	if (mode == TABLE_CLAMP) value = fmin(fmax(value, 0.0), 255.0);
+	else if (mode == TABLE_MASK && fabs(value) < 9e18) value = (double)((long long)value & 0xFF);
+	if (!(value >= 0 && value <= 255)) return false;
+	*result = (byte)value;
+	return true;
+}
@@ -0,0 +1,61 @@
+#ifndef CBA_TABLE_H
+#define CBA_TABLE_H
+#pragma once
+#include "stdafx.h"
+#include "context.h"
+#include <string_view>
+
+// What .table does with a value that doesn't fit in a byte
+#define TABLE_STRICT 0x00	/* Reports an error */
+#define TABLE_CLAMP  0x01	/* Clamps it to 0-255 */
+#define TABLE_MASK   0x02	/* Keeps the low 8 bits, so -1 is 0xFF */
+
+// Functions an expression may call, with how many arguments they take
+#define TABLE_FUNCTIONS \
+	X(sin  , 1)\
+	X(cos  , 1)\
+	X(sqrt , 1)\
+	X(abs  , 1)\
+	X(floor, 1)\
+	X(ceil , 1)\
+	X(round, 1)\
+	X(min  , 2)\
+	X(max  , 2)
+
+#define X(a, b) TABLE_FN_##a,
+enum TableFunctionValues {
+	TABLE_FUNCTIONS
+	TABLE_FN_COUNT
+};
+#undef X
+
+struct table_op {
+	uint kind;
+	double value;	/* For a pushed constant */
+};
+
+// An expression compiled to postfix, run once per index
+struct table_program {
+	std::vector<table_op> ops;
+};
+
+// Gives the value of a name in an expression that isn't built in, or false
+typedef bool(*table_lookup)(asm_context& ctx, std::string_view name, double* value);
+
+/*
+	Compiles an infix expression over i (the index), n (the number of
+	entries) and pi, with + - * / %, parentheses and TABLE_FUNCTIONS.
+	Numbers are decimal (with an optional fraction) or $/0x hex. Any other
+	name goes to lookup, which sees it once, here. Returns false and sets
+	error on a malformed expression.
+*/
+bool TABLE_Compile(asm_context& ctx, std::string_view text, table_lookup lookup, table_program& program, std::string& error);
+
+// The expression's value at one index; not finite if it divided by zero or left its domain
+double TABLE_Evaluate(const table_program& program, double index, double count);
+
+// Rounds a value to the nearest whole number and fits it in a byte as mode says.
+// Returns false if the mode is TABLE_STRICT and it doesn't fit.
+bool TABLE_ToByte(double value, uint mode, byte* result);
+
+#endif
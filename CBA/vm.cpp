@@ -0,0 +1,273 @@
+#include "vm.h"
+#include "profile.h"
+#include <cstring>
+
+static const byte font[16 * VM_FONT_HEIGHT] = {
+	0xF0, 0x90, 0x90, 0x90, 0xF0,	/* 0 */
+	0x20, 0x60, 0x20, 0x20, 0x70,	/* 1 */
+	0xF0, 0x10, 0xF0, 0x80, 0xF0,	/* 2 */
+	0xF0, 0x10, 0xF0, 0x10, 0xF0,	/* 3 */
+	0x90, 0x90, 0xF0, 0x10, 0x10,	/* 4 */
+	0xF0, 0x80, 0xF0, 0x10, 0xF0,	/* 5 */
+	0xF0, 0x80, 0xF0, 0x90, 0xF0,	/* 6 */
+	0xF0, 0x10, 0x20, 0x40, 0x40,	/* 7 */
+	0xF0, 0x90, 0xF0, 0x90, 0xF0,	/* 8 */
+	0xF0, 0x90, 0xF0, 0x10, 0xF0,	/* 9 */
+	0xF0, 0x90, 0xF0, 0x90, 0x90,	/* A */
+	0xE0, 0x90, 0xE0, 0x90, 0xE0,	/* B */
+	0xF0, 0x80, 0x80, 0x80, 0xF0,	/* C */
+	0xE0, 0x90, 0x90, 0x90, 0xE0,	/* D */
+	0xF0, 0x80, 0xF0, 0x80, 0xF0,	/* E */
+	0xF0, 0x80, 0xF0, 0x80, 0x80,	/* F */
+};
+
+#define OP_X(op)   (((op) >> 8) & 0xF)
+#define OP_Y(op)   (((op) >> 4) & 0xF)
+#define OP_N(op)   ((op) & 0xF)
+#define OP_NN(op)  ((op) & 0xFF)
+#define OP_NNN(op) ((op) & 0xFFF)
+#define ADDRESS(a) ((a) & (CHIP8_MEMSIZE - 1))
+
+typedef void(*vm_handler)(chip8_vm&, word);
+#define VmOp(a) static void vm_##a(chip8_vm& vm, word op)
+
+static uint NextRandom(uint& state) {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+static inline void Skip(chip8_vm& vm, bool condition) {
+	if (condition) vm.pc += INSTRUCTION_SIZE;
+}
+
+/*****************************************/
+/*										 */
+/*			  INSTRUCTIONS				 */
+/*                                       */
+/*****************************************/
+VmOp(invalid) {
+	vm.pc -= INSTRUCTION_SIZE;
+	vm.status = VM_FAULT_OPCODE;
+}
+
+VmOp(sys) {
+	if (op == 0x00E0) std::memset(vm.screen, 0, sizeof(vm.screen));
+	else if (op == 0x00EE) {
+		if (vm.sp == 0) {
+			vm.pc -= INSTRUCTION_SIZE;
+			vm.status = VM_FAULT_STACK;
+			return;
+		}
+		vm.pc = vm.stack[--vm.sp];
+	}
+	//Any other 0nnn is a call to machine code, which is ignored
+}
+VmOp(jp) { vm.pc = OP_NNN(op); }
+VmOp(call) {
+	if (vm.sp == VM_STACK_SIZE) {
+		vm.pc -= INSTRUCTION_SIZE;
+		vm.status = VM_FAULT_STACK;
+		return;
+	}
+	vm.stack[vm.sp++] = vm.pc;
+	vm.pc = OP_NNN(op);
+}
+VmOp(se_nn)  { Skip(vm, vm.v[OP_X(op)] == OP_NN(op)); }
+VmOp(sne_nn) { Skip(vm, vm.v[OP_X(op)] != OP_NN(op)); }
+VmOp(se_vy)  { Skip(vm, vm.v[OP_X(op)] == vm.v[OP_Y(op)]); }
+VmOp(sne_vy) { Skip(vm, vm.v[OP_X(op)] != vm.v[OP_Y(op)]); }
+VmOp(ld_nn)  { vm.v[OP_X(op)] = OP_NN(op); }
+VmOp(add_nn) { vm.v[OP_X(op)] += OP_NN(op); }
+VmOp(ld_i)   { vm.i = OP_NNN(op); }
+VmOp(jp_v0)  { vm.pc = ADDRESS(OP_NNN(op) + vm.v[0]); }
+VmOp(rand)   { vm.v[OP_X(op)] = (NextRandom(vm.rand_state) >> 24) & OP_NN(op); }
+
+//VF is written last, so it holds the flag even when it is also Vx
+VmOp(ld_vy)  { vm.v[OP_X(op)] = vm.v[OP_Y(op)]; }
+VmOp(or)     { vm.v[OP_X(op)] |= vm.v[OP_Y(op)]; }
+VmOp(and)    { vm.v[OP_X(op)] &= vm.v[OP_Y(op)]; }
+VmOp(xor)    { vm.v[OP_X(op)] ^= vm.v[OP_Y(op)]; }
+VmOp(add_vy) {
+	uint sum = vm.v[OP_X(op)] + vm.v[OP_Y(op)];
+	vm.v[OP_X(op)] = sum & 0xFF;
+	vm.v[0xF] = sum >> 8;
+}
+VmOp(sub) {
+	byte flag = vm.v[OP_X(op)] >= vm.v[OP_Y(op)];
+	vm.v[OP_X(op)] -= vm.v[OP_Y(op)];
+	vm.v[0xF] = flag;
+}
+VmOp(shr) {
+	byte flag = vm.v[OP_X(op)] & 0x01;
+	vm.v[OP_X(op)] >>= 1;
+	vm.v[0xF] = flag;
+}
+VmOp(subn) {
+	byte flag = vm.v[OP_Y(op)] >= vm.v[OP_X(op)];
+	vm.v[OP_X(op)] = vm.v[OP_Y(op)] - vm.v[OP_X(op)];
+	vm.v[0xF] = flag;
+}
+VmOp(shl) {
+	byte flag = vm.v[OP_X(op)] >> 7;
+	vm.v[OP_X(op)] <<= 1;
+	vm.v[0xF] = flag;
+}
+
+VmOp(draw) {
+	uint x = vm.v[OP_X(op)] % VM_SCREEN_WIDTH;
+	uint y = vm.v[OP_Y(op)] % VM_SCREEN_HEIGHT;
+	byte collision = 0;
+	for (uint row = 0; row < OP_N(op); row++) {
+		unsigned long long sprite = (unsigned long long)vm.memory[ADDRESS(vm.i + row)] << 56;
+		if (x != 0) sprite = (sprite >> x) | (sprite << (64 - x));
+		unsigned long long& line = vm.screen[(y + row) % VM_SCREEN_HEIGHT];
+		collision |= (line & sprite) != 0;
+		line ^= sprite;
+	}
+	vm.v[0xF] = collision;
+}
+
+VmOp(skp)  { Skip(vm, vm.keys[vm.v[OP_X(op)] & 0xF]); }
+VmOp(sknp) { Skip(vm, !vm.keys[vm.v[OP_X(op)] & 0xF]); }
+
+VmOp(ld_vx_dt) { vm.v[OP_X(op)] = vm.dt; }
+VmOp(wkp) {
+	vm.wait_register = OP_X(op);
+	vm.status = VM_WAITING_KEY;
+}
+VmOp(ld_dt) { vm.dt = vm.v[OP_X(op)]; }
+VmOp(ld_st) { vm.st = vm.v[OP_X(op)]; }
+VmOp(add_i) { vm.i += vm.v[OP_X(op)]; }
+VmOp(fnt)   { vm.i = VM_FONT_START + (vm.v[OP_X(op)] & 0xF) * VM_FONT_HEIGHT; }
+VmOp(bcd) {
+	byte value = vm.v[OP_X(op)];
+	vm.memory[ADDRESS(vm.i)] = value / 100;
+	vm.memory[ADDRESS(vm.i + 1)] = (value / 10) % 10;
+	vm.memory[ADDRESS(vm.i + 2)] = value % 10;
+}
+VmOp(store) {
+	for (uint r = 0; r <= OP_X(op); r++) vm.memory[ADDRESS(vm.i + r)] = vm.v[r];
+}
+VmOp(load) {
+	for (uint r = 0; r <= OP_X(op); r++) vm.v[r] = vm.memory[ADDRESS(vm.i + r)];
+}
+
+/*****************************************/
+/*										 */
+/*			  DISPATCH TABLES			 */
+/*                                       */
+/*****************************************/
+// 8xyN by N, ExNN and FxNN by NN
+struct dispatch_tables {
+	vm_handler alu[16];
+	vm_handler key[256];
+	vm_handler misc[256];
+
+	constexpr dispatch_tables() : alu(), key(), misc() {
+		for (uint n = 0; n < 16; n++) alu[n] = vm_invalid;
+		for (uint nn = 0; nn < 256; nn++) key[nn] = misc[nn] = vm_invalid;
+		alu[0x0] = vm_ld_vy;
+		alu[0x1] = vm_or;
+		alu[0x2] = vm_and;
+		alu[0x3] = vm_xor;
+		alu[0x4] = vm_add_vy;
+		alu[0x5] = vm_sub;
+		alu[0x6] = vm_shr;
+		alu[0x7] = vm_subn;
+		alu[0xE] = vm_shl;
+		key[0x9E] = vm_skp;
+		key[0xA1] = vm_sknp;
+		misc[0x07] = vm_ld_vx_dt;
+		misc[0x0A] = vm_wkp;
+		misc[0x15] = vm_ld_dt;
+		misc[0x18] = vm_ld_st;
+		misc[0x1E] = vm_add_i;
+		misc[0x29] = vm_fnt;
+		misc[0x33] = vm_bcd;
+		misc[0x55] = vm_store;
+		misc[0x65] = vm_load;
+	}
+};
+static constexpr dispatch_tables tables;
+
+VmOp(alu)  { tables.alu[OP_N(op)](vm, op); }
+VmOp(key)  { tables.key[OP_NN(op)](vm, op); }
+VmOp(misc) { tables.misc[OP_NN(op)](vm, op); }
+
+// Indexed by the top nibble of the instruction
+static const vm_handler dispatch[16] = {
+	vm_sys,   vm_jp,     vm_call,  vm_se_nn,
+	vm_sne_nn, vm_se_vy, vm_ld_nn, vm_add_nn,
+	vm_alu,   vm_sne_vy, vm_ld_i,  vm_jp_v0,
+	vm_rand,  vm_draw,   vm_key,   vm_misc,
+};
+
+/*****************************************/
+/*										 */
+/*				MACHINE					 */
+/*                                       */
+/*****************************************/
+void VM_Reset(chip8_vm& vm, const byte* rom, uint size, uint seed) {
+	std::memset(&vm, 0, sizeof(vm));
+	std::memcpy(vm.memory + VM_FONT_START, font, sizeof(font));
+	if (size > MAX_ROMSIZE) size = MAX_ROMSIZE;
+	std::memcpy(vm.memory + CHIP8_MEMSTART, rom, size);
+	vm.pc = CHIP8_MEMSTART;
+	vm.rand_state = seed * 0x9E3779B9 + 1;
+	if (vm.rand_state == 0) vm.rand_state = 1;
+	vm.status = VM_RUNNING;
+}
+
+void VM_Step(chip8_vm& vm) {
+	if (vm.status != VM_RUNNING) return;
+	if (vm.pc > CHIP8_MEMSIZE - INSTRUCTION_SIZE) {
+		vm.status = VM_FAULT_PC;
+		return;
+	}
+	uint pc = vm.pc;
+	word op = (vm.memory[pc] << 8) | vm.memory[pc + 1];
+	vm.pc += INSTRUCTION_SIZE;
+	vm.cycles++;
+	dispatch[op >> 12](vm, op);
+	if (vm.profile && vm.status <= VM_WAITING_KEY) PROFILE_Step(*vm.profile, pc, op);
+}
+
+void VM_RunFrame(chip8_vm& vm, uint cycles) {
+	for (uint c = 0; c < cycles && vm.status == VM_RUNNING; c++) VM_Step(vm);
+	if (vm.dt > 0) vm.dt--;
+	if (vm.st > 0) vm.st--;
+	vm.frames++;
+}
+
+void VM_SetKey(chip8_vm& vm, uint key, bool down) {
+	key &= 0xF;
+	vm.keys[key] = down;
+	if (down && vm.status == VM_WAITING_KEY) {
+		vm.v[vm.wait_register] = key;
+		vm.status = VM_RUNNING;
+	}
+}
+
+unsigned long long VM_ScreenHash(const chip8_vm& vm) {
+	unsigned long long hash = 0xCBF29CE484222325ULL;
+	for (unsigned long long line : vm.screen) {
+		for (uint b = 0; b < 8; b++) {
+			hash ^= (line >> (56 - b * 8)) & 0xFF;
+			hash *= 0x100000001B3ULL;
+		}
+	}
+	return hash;
+}
+
+const char* VM_StatusName(uint status) {
+	switch (status) {
+	case VM_RUNNING:      return "running";
+	case VM_WAITING_KEY:  return "waiting for a key";
+	case VM_FAULT_OPCODE: return "invalid instruction";
+	case VM_FAULT_STACK:  return "stack overflow/underflow";
+	case VM_FAULT_PC:     return "program counter out of memory";
+	}
+	return "unknown";
+}
@@ -0,0 +1,69 @@
+#ifndef CBA_VM_H
+#define CBA_VM_H
+#pragma once
+#include "stdafx.h"
+
+#define VM_SCREEN_WIDTH  64
+#define VM_SCREEN_HEIGHT 32
+#define VM_STACK_SIZE    16
+#define VM_KEY_COUNT     16
+#define VM_FONT_START    0x000
+#define VM_FONT_HEIGHT   5
+#define VM_CYCLES_PER_FRAME 10	/* Instructions per 60Hz timer tick */
+
+#define VM_RUNNING         0x00
+#define VM_WAITING_KEY     0x01	/* Stopped on wkp until VM_SetKey presses a key */
+#define VM_FAULT_OPCODE    0x02
+#define VM_FAULT_STACK     0x03
+#define VM_FAULT_PC        0x04
+
+struct vm_profile;
+
+/*
+	A headless Chip-8, following Cowgod's reference (the same semantics the
+	assembler documents in LANGUAGE.txt): shr/shl shift Vx in place, ld [i]
+	leaves I alone, rand ANDs a random byte with NN and sprites wrap around
+	the screen edges. Each screen row is one 64-bit word, leftmost pixel in
+	the top bit, so a sprite row is drawn with a single rotate and XOR.
+	rand comes from a per-machine xorshift stream, so a given seed always
+	plays out the same way.
+*/
+struct chip8_vm {
+	byte memory[CHIP8_MEMSIZE];
+	byte v[16];
+	word i;
+	word pc;
+	word stack[VM_STACK_SIZE];
+	uint sp;
+	byte dt;
+	byte st;
+	unsigned long long screen[VM_SCREEN_HEIGHT];
+	bool keys[VM_KEY_COUNT];
+	uint wait_register;
+	uint rand_state;
+	uint status;
+	unsigned long long cycles;
+	uint frames;
+	vm_profile* profile;	/* Counts every instruction when set (after VM_Reset) */
+};
+
+// Clears the machine, loads the font and the ROM at CHIP8_MEMSTART and
+// seeds rand. ROM bytes past the end of memory are ignored.
+void VM_Reset(chip8_vm& vm, const byte* rom, uint size, uint seed);
+
+// Executes one instruction, unless the machine is waiting or has faulted
+void VM_Step(chip8_vm& vm);
+
+// Executes up to cycles instructions (stopping early if the machine waits
+// or faults), then ticks the delay and sound timers once.
+void VM_RunFrame(chip8_vm& vm, uint cycles);
+
+// Presses or releases a key. Pressing one releases a pending wkp.
+void VM_SetKey(chip8_vm& vm, uint key, bool down);
+
+// 64-bit FNV-1a of the screen, for comparing frames between runs
+unsigned long long VM_ScreenHash(const chip8_vm& vm);
+
+const char* VM_StatusName(uint status);
+
+#endif
@@ -0,0 +1,74 @@
+#include "watch.h"
+#include "assembler.h"
+#include "batch.h"
+#include <thread>
+
+struct watched_file {
+	long long mtime;
+	long long size;
+};
+
+// Stamps every file the last build read, in source_files order
+static std::vector<watched_file> StampFiles(const std::vector<std::string>& paths) {
+	std::vector<watched_file> stamps(paths.size());
+	for (uint i = 0; i < paths.size(); i++) {
+		if (!INCLUDE_FileStamp(paths[i], &stamps[i].mtime, &stamps[i].size))
+			stamps[i] = { -1, -1 };
+	}
+	return stamps;
+}
+
+static std::unique_ptr<asm_context> FullBuild(std::string path, const asm_options& options, std::shared_ptr<include_cache> includes) {
+	std::unique_ptr<asm_context> ctx(new asm_context());
+	ctx->options = options;
+	ctx->includes = includes;
+	ASM_Begin(*ctx, path);
+	return ctx;
+}
+
+// Returns the first layout mark for a changed file, or -1 if everything
+// has to be reassembled
+static int FirstChangedMark(const asm_context& ctx, const std::vector<bool>& changed) {
+	if (ctx.source_files.empty() || changed[0]) return -1;
+	for (uint i = 0; i < ctx.marks.size(); i++) {
+		uint file = ctx.marks[i].source_file;
+		if (file < changed.size() && changed[file]) return i;
+	}
+	return -1;
+}
+
+int WATCH_Run(std::string path, const asm_options& options) {
+	std::shared_ptr<include_cache> includes = std::make_shared<include_cache>();
+	std::unique_ptr<asm_context> ctx = FullBuild(path, options, includes);
+	BATCH_PrintResult(*ctx);
+	std::vector<std::string> paths = ctx->source_files.empty() ? std::vector<std::string>{ path } : ctx->source_files;
+	std::vector<watched_file> stamps = StampFiles(paths);
+	printf("\nWatching %i file(s) for changes...\n", (uint)stamps.size());
+	fflush(stdout);
+
+	for (;;) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(WATCH_POLL_MS));
+		std::vector<watched_file> current = StampFiles(paths);
+		std::vector<bool> changed(current.size());
+		bool any_changed = false;
+		for (uint i = 0; i < current.size(); i++) {
+			changed[i] = current[i].mtime != stamps[i].mtime || current[i].size != stamps[i].size;
+			any_changed = any_changed || changed[i];
+		}
+		if (!any_changed) continue;
+
+		stopwatch timer = STATS_Start();
+		int mark = FirstChangedMark(*ctx, changed);
+		if (mark < 0) ctx = FullBuild(path, options, includes);
+		else ASM_Reassemble(*ctx, mark);
+		double seconds = STATS_Seconds(timer);
+
+		printf("\n");
+		BATCH_PrintResult(*ctx);
+		printf("%s in %.3f ms.\n", (mark < 0) ? "Assembled" : "Reassembled", seconds * 1000);
+		paths = ctx->source_files.empty() ? std::vector<std::string>{ path } : ctx->source_files;
+		stamps = StampFiles(paths);
+		fflush(stdout);
+	}
+	return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef CBA_WATCH_H
+#define CBA_WATCH_H
+#pragma once
+#include "stdafx.h"
+#include "context.h"
+
+// How often the watched files are checked for changes
+#define WATCH_POLL_MS 100
+
+// Assembles path, then keeps the assembled state in memory and reassembles
+// whenever the source or one of its includes changes. Runs until killed.
+int WATCH_Run(std::string path, const asm_options& options);
+
+#endif
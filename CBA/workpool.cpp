@@ -0,0 +1,58 @@
+#include "workpool.h"
+#include <thread>
+#include <mutex>
+#include <deque>
+
+struct work_queue {
+	std::mutex lock;
+	std::deque<uint> jobs;
+};
+
+static bool PopJob(work_queue& queue, uint* job) {
+	std::lock_guard<std::mutex> guard(queue.lock);
+	if (queue.jobs.empty()) return false;
+	*job = queue.jobs.front();
+	queue.jobs.pop_front();
+	return true;
+}
+
+static bool StealJob(std::vector<work_queue>& queues, uint thief, uint* job) {
+	for (uint i = 1; i < queues.size(); i++) {
+		work_queue& victim = queues[(thief + i) % queues.size()];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (victim.jobs.empty()) continue;
+		*job = victim.jobs.back();
+		victim.jobs.pop_back();
+		return true;
+	}
+	return false;
+}
+
+uint DefaultThreadCount() {
+	uint count = std::thread::hardware_concurrency();
+	return (count > 0) ? count : 1;
+}
+
+void RunJobs(uint job_count, uint thread_count, const std::function<void(uint)>& job) {
+	if (thread_count > job_count) thread_count = job_count;
+	if (thread_count <= 1) {
+		for (uint i = 0; i < job_count; i++) job(i);
+		return;
+	}
+
+	//No jobs are added once the workers start, so a worker that finds
+	//every queue empty can safely exit.
+	std::vector<work_queue> queues(thread_count);
+	for (uint i = 0; i < job_count; i++)
+		queues[i * thread_count / job_count].jobs.push_back(i);
+
+	std::vector<std::thread> workers;
+	for (uint t = 0; t < thread_count; t++) {
+		workers.emplace_back([&queues, &job, t]() {
+			uint next;
+			while (PopJob(queues[t], &next) || StealJob(queues, t, &next))
+				job(next);
+		});
+	}
+	for (auto& worker : workers) worker.join();
+}
@@ -0,0 +1,15 @@
+#ifndef CBA_WORKPOOL_H
+#define CBA_WORKPOOL_H
+#pragma once
+#include "stdafx.h"
+#include <functional>
+
+/*
+	Runs job(0) to job(job_count - 1) across thread_count worker threads.
+	Every worker starts with an even share of the jobs, and once its own
+	queue runs dry it steals from the back of the other workers' queues.
+*/
+void RunJobs(uint job_count, uint thread_count, const std::function<void(uint)>& job);
+uint DefaultThreadCount();
+
+#endif